@@ -1,58 +1,195 @@
+// Articulation points, bridges and biconnected components of an undirected graph, all from one DFS: input `n m`
+// followed by m edges `a b` of vertices in [1, n], output the number of articulation points and the points in
+// increasing order. `./articulationPoints blocks` outputs also
+//   the number of bridges and the bridges as edge numbers, from 1 in input order,
+//   the number of blocks and the block of every edge in input order, from 0, -1 for loops,
+//   the block-cut tree, see blockCutTree(): the number of nodes, then the neighbours of every node per line.
+// The graph may be disconnected, have multiple edges and loops.
+// Adjacency is in CSR arrays sized at runtime and the DFS keeps its stack in arrays as well, so memory is a
+// fixed O(n + m) allocated up front -- 4 ints per edge while reading, 3 after -- and no recursion limits the
+// depth, for graphs of millions of vertices and 10^7+ edges.
+
 #include <bits/stdc++.h>
 
 using namespace std;
 
-#define N 5003
-#define M 200005
+int n, m;
+
+// CSR: edges of v are adj[start[v]] .. adj[start[v + 1] - 1], as edge numbers. Ends of edge e are stored as
+// other[e] = a ^ b, so the other end of e seen from v is v ^ other[e].
+vector<int> start, adj, other;
+
+vector<int> low;  // lowest DFS timestamp reachable from the subtree by one back edge
+vector<int> vis;  // DFS timestamp, 0 if not visited yet
+
+vector<uint64_t> crit;    // bitmap of articulation points
+vector<uint64_t> bridges;  // bitmap of bridges, by edge number
+
+void SET_CRITICAL(int v) { crit[v >> 6] |= 1ull << (v & 63); }  // vertices can be set multiple times
+void SET_BRIDGE(int e) { bridges[e >> 6] |= 1ull << (e & 63); }
+bool IS_CRITICAL(int v) { return crit[v >> 6] >> (v & 63) & 1; }
 
-vector<vector<int> > V(N);
-int                  low[N];
-int                  vis[N];
+// Biconnected components (blocks) are numbered in the order they are completed. A block is completed when its
+// topmost tree edge is done, that is when the child v of p has low[v] >= vis[p]; its edges are then the top of
+// the edge stack down to that tree edge. blockTop[b] is the vertex p the block hangs on.
+vector<int> block;  // block of every edge, -1 for loops, which belong to none
+vector<int> blockTop, edgeStack;
+int         blocks = 0;
 
-set<int> crit;
+// stdin read in large blocks
+int readInt() {
+    static char   buffer[1 << 16];
+    static size_t length = 0, position = 0;
+    auto          next   = [&]() -> int {
+        if (position == length && (position = 0, length = fread(buffer, 1, sizeof(buffer), stdin)) == 0) return EOF;
+        return buffer[position++];
+    };
+    int c = next();
+    while (c != EOF && (c < '0' || c > '9')) c = next();
+    int x = 0;
+    for (; c >= '0' && c <= '9'; c = next()) x = x * 10 + (c - '0');
+    return x;
+}
 
-void SET_CRITICAL(int v) { // CAN ADD VERTICES MULTIPLE TIMES!!! 
-    crit.insert(v);
+// edges as pairs of ends in `ends`, which becomes `other`
+void buildCSR(vector<int>& ends) {
+    start.assign(n + 2, 0);
+    for (int v : ends) start[v + 1]++;
+    partial_sum(start.begin(), start.end(), start.begin());
+    adj.resize(2 * m);
+    vector<int> fill(start.begin(), start.end() - 1);
+    for (int e = 0; e < 2 * m; e++) adj[fill[ends[e]]++] = e / 2;
+    for (int e = 0; e < m; e++) ends[e] = ends[2 * e] ^ ends[2 * e + 1];  // in place, as 2e >= e
+    ends.resize(m);
+    ends.shrink_to_fit();
+    other.swap(ends);
 }
 
-void DFS(int p, int v) {
-    vis[v] = low[v] = vis[p] + 1;  // timestamp
-    //cerr << "\nIN#\t" << v << ": vis:" << vis[v] << "\tlow:" << low[v];
-    int children    = 0;
-    for (auto w : V[v]) {
-        if (w == p) continue;
-        if (vis[w] > 0)
-            low[v] = min(low[v], vis[w]);  // back edge
-        else {
-            DFS(v, w);
-            low[v] = min(low[v], low[w]);
-            if (vis[v] <= low[w] && p != 0)  // for non-root
-                SET_CRITICAL(v);
-            children++;
+// Iterative DFS from root. The stack `path` holds the path from root, cursor[v] is the position in the adjacency
+// of v to continue from and parentEdge[v] the tree edge v was entered by, skipped instead of the parent vertex,
+// so that a multiple edge to the parent is a back edge. Tree edges and back edges to ancestors go on the edge
+// stack, back edges to descendants were put there from the other end already.
+vector<int> path, cursor, parentEdge;
+int         timestamp = 0;
+
+void DFS(int root) {
+    int top = 0, edges = 0;  // of path and of edgeStack
+    path[top++]      = root;
+    parentEdge[root] = -1;
+    cursor[root]     = start[root];
+    vis[root] = low[root] = ++timestamp;
+    int children     = 0;
+    while (top > 0) {
+        int v = path[top - 1];
+        if (cursor[v] < start[v + 1]) {
+            int e = adj[cursor[v]++];
+            if (e == parentEdge[v]) continue;
+            int w = v ^ other[e];
+            if (vis[w] == 0) {
+                vis[w] = low[w]    = ++timestamp;
+                parentEdge[w]      = e;
+                cursor[w]          = start[w];
+                path[top++]        = w;
+                edgeStack[edges++] = e;
+            } else if (vis[w] < vis[v]) {
+                low[v]             = min(low[v], vis[w]);  // back edge
+                edgeStack[edges++] = e;
+            }
+            continue;
+        }
+        if (--top == 0) break;
+        int p  = path[top - 1];  // v is done, back in its parent
+        low[p] = min(low[p], low[v]);
+        if (vis[p] <= low[v]) {
+            if (p != root) SET_CRITICAL(p);
+            if (vis[p] < low[v]) SET_BRIDGE(parentEdge[v]);
+            int e;
+            do block[e = edgeStack[--edges]] = blocks;
+            while (e != parentEdge[v]);
+            blockTop[blocks++] = p;
         }
+        if (p == root) children++;
     }
-    //cerr << "\nOUT#\t" << v << ": vis:" << vis[v] << "\tlow:" << low[v];
-    if (p == 0 && children > 1)
-        SET_CRITICAL(v);
+    if (children > 1) SET_CRITICAL(root);
 }
 
-int main() {
-    for (int i = 0; i < N; i++) low[i] = vis[i] = -1;
+// every component from its lowest vertex
+void articulationPoints() {
+    low.assign(n + 1, 0);
+    vis.assign(n + 1, 0);
+    path.resize(n + 1);
+    cursor.resize(n + 1);
+    parentEdge.resize(n + 1);
+    crit.assign(n / 64 + 1, 0);
+    bridges.assign(m / 64 + 1, 0);
+    block.assign(m, -1);
+    blockTop.resize(m);
+    edgeStack.resize(m);
+    timestamp = blocks = 0;
+    for (int v = 1; v <= n; v++)
+        if (vis[v] == 0) DFS(v);
+}
 
-    int n, m;
-    cin >> n >> m;
-    while (m--) {
-        int a, b;
-        cin >> a >> b;
-        V[a].push_back(b);
-        V[b].push_back(a);
-    }
+// Block-cut tree in CSR: nodes [0, blocks) are the blocks, then the articulation points in increasing order.
+// Neighbours of node x are treeAdj[treeStart[x]] .. treeAdj[treeStart[x + 1] - 1]. An articulation point c is in
+// the blocks it is the top of, and, unless it is a root of the DFS, in the block of its tree edge; no other
+// block can have it. treeNode[v] is the node of vertex v, its block if it is not an articulation point, -1 if
+// it has no edges other than loops.
+vector<int> treeStart, treeAdj, treeNode;
 
-    vis[0] = 0;  // 0 doesn't belong to the tree
-    DFS(0, 1);
-    cout << crit.size() << "\n";
-    for (auto w : crit) cout << w << " ";
-    return 0;
+void blockCutTree() {
+    treeNode.assign(n + 1, -1);
+    int nodes = blocks;
+    for (int v = 1; v <= n; v++)
+        if (IS_CRITICAL(v)) treeNode[v] = nodes++;
+    for (int v = 1; v <= n; v++)
+        for (int i = start[v]; i < start[v + 1] && treeNode[v] < 0; i++) treeNode[v] = block[adj[i]];
+
+    vector<pair<int, int>> edges;  // (block, articulation point)
+    for (int b = 0; b < blocks; b++)
+        if (IS_CRITICAL(blockTop[b])) edges.push_back({b, treeNode[blockTop[b]]});
+    for (int v = 1; v <= n; v++)
+        if (IS_CRITICAL(v) && parentEdge[v] >= 0) edges.push_back({block[parentEdge[v]], treeNode[v]});
+
+    treeStart.assign(nodes + 1, 0);
+    for (auto [b, c] : edges) treeStart[b + 1]++, treeStart[c + 1]++;
+    partial_sum(treeStart.begin(), treeStart.end(), treeStart.begin());
+    treeAdj.resize(2 * edges.size());
+    vector<int> fill(treeStart.begin(), treeStart.end() - 1);
+    for (auto [b, c] : edges) treeAdj[fill[b]++] = c, treeAdj[fill[c]++] = b;
+}
+
+// numbers set in bitmap, from the count
+void appendBitmap(string& out, const vector<uint64_t>& bitmap, int offset) {
+    int count = 0;
+    for (uint64_t word : bitmap) count += __builtin_popcountll(word);
+    out += to_string(count) + "\n";
+    for (int i = 0; i < (int)bitmap.size(); i++)
+        for (uint64_t word = bitmap[i]; word != 0; word &= word - 1)
+            out += to_string(i * 64 + __builtin_ctzll(word) + offset) + " ";
 }
 
-// 
\ No newline at end of file
+int main(int argc, char* argv[]) {
+    n = readInt(), m = readInt();
+    vector<int> ends(2 * m);
+    for (int& v : ends) v = readInt();
+    buildCSR(ends);
+    articulationPoints();
+
+    string out;
+    appendBitmap(out, crit, 0);
+    if (argc > 1 && string(argv[1]) == "blocks") {
+        blockCutTree();
+        out += "\n";
+        appendBitmap(out, bridges, 1);
+        out += "\n" + to_string(blocks) + "\n";
+        for (int e = 0; e < m; e++) out += to_string(block[e]) + " ";
+        out += "\n" + to_string(treeStart.size() - 1) + "\n";
+        for (int x = 0; x + 1 < (int)treeStart.size(); x++) {
+            for (int i = treeStart[x]; i < treeStart[x + 1]; i++) out += to_string(treeAdj[i]) + " ";
+            out += "\n";
+        }
+    }
+    fwrite(out.data(), 1, out.size(), stdout);
+    return 0;
+}
@@ -2,41 +2,855 @@
 //   u[nion] <a> <b> joins sets
 //   f[ind] <a> gets the representant of the set
 //   <CTRL+D>  exits
+// Elements are in [0, 10^7), `./unionFind sparse` takes any 64-bit IDs instead.
+// `./unionFind checkpoint FILE` keeps the table in FILE, mapped back on the next start, see UF_Header.
+// `./unionFind [sparse | checkpoint FILE] batch [N]` reads the same commands through a large buffer and flushes
+// output every N finds, or only at the end without N, for streams of millions of commands.
+// `./unionFind offline` answers connectivity queries of a log of edge insertions and removals, see offline().
+// `./unionFind components [-b] [-n N] FILE [threads]` labels connected components of an edge list file in
+// parallel, see components().
+//
+// `./unionFind bench [find|concurrent [threads]|sparse|aggregate]` compares the recursive and the iterative find
+// at 10^7 elements, the concurrent union-find against the sequential one on random edges and measures the sparse
+// one and the one with aggregates.
+// Iterative path halving is the default UF_find, compile with -DUF_RECURSIVE for the recursive one.
+// Compile with -pthread.
 
 #include <bits/stdc++.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 using namespace std;
 
-vector<int> UF(10000007, -1);  // parent/rank table. Sign < 0 is the size of the set
+int*        UF;          // parent/rank table. Sign < 0 is the size of the set
+vector<int> UF_storage;  // memory of UF, unless it is mapped from a checkpoint
+
+void UF_init(int n) {
+    UF_storage.assign(n, -1);
+    UF = UF_storage.data();
+}
 
 inline int UF_rank(int x) { return -UF[x]; }  // valid only for set representatives aka UF[x] < 0
 
-int UF_find(int v) { return UF[v] < 0 ? v : (UF[v] = UF_find(UF[v])); }
+// full path compression, one stack frame per hop
+int UF_find_recursive(int v) { return UF[v] < 0 ? v : (UF[v] = UF_find_recursive(UF[v])); }
+
+// path halving: every other node on the path is linked to its grandparent, no recursion
+int UF_find_halving(int v) {
+    for (; UF[v] >= 0; v = UF[v])
+        if (UF[UF[v]] >= 0) UF[v] = UF[UF[v]];
+    return v;
+}
+
+#ifdef UF_RECURSIVE
+inline int UF_find(int v) { return UF_find_recursive(v); }
+#else
+inline int UF_find(int v) { return UF_find_halving(v); }
+#endif
 
 //returns root, rank as tree size heuristic
+template <int (*find)(int) = UF_find>
 int UF_union(int a, int b) {
-    if ((a = UF_find(a)) == (b = UF_find(b))) return a;
+    if ((a = find(a)) == (b = find(b))) return a;
     if (UF_rank(a) < UF_rank(b)) swap(a, b);
     UF[a] += UF[b];
     return UF[b] = a;
 }
 
-int main() {
+// Checkpoint of UF: a header followed by the table as it is in memory. The file is mapped shared and writable and
+// UF points into it, so every union lands in the page cache and survives a crash of the process; a restart maps
+// it back in milliseconds instead of replaying the unions. A crash in the middle of a union can leave the size of
+// a root off, which only weakens the heuristic. UF_sync writes dirty pages to disk at most every
+// UF_SYNC_PERIOD, against a crash of the system.
+struct UF_Header {
+    char    magic[8];
+    int64_t n;
+};
+
+const char UF_MAGIC[8]     = {'U', 'F', 'T', 'A', 'B', 'L', 'E', '1'};
+const auto UF_SYNC_PERIOD = chrono::seconds(1);
+
+UF_Header* UF_file = NULL;
+size_t     UF_fileSize;
+
+void UF_unmap() {
+    if (!UF_file) return;
+    msync(UF_file, UF_fileSize, MS_SYNC);
+    munmap(UF_file, UF_fileSize);
+    UF_file = NULL;
+}
+
+// maps the checkpoint at path, created with n singletons if it doesn't exist; false with errno on failure
+bool UF_map(const char* path, int n) {
+    int         fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) return false;
+    bool   fresh = st.st_size == 0;
+    size_t size  = fresh ? sizeof(UF_Header) + (size_t)n * sizeof(int) : st.st_size;
+    if (size < sizeof(UF_Header)) errno = EINVAL;
+    if (size < sizeof(UF_Header) || (fresh && ftruncate(fd, size) < 0)) return close(fd), false;
+    void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+
+    UF_Header* header = (UF_Header*)data;
+    if (fresh) {  // magic goes last, so that a file cut short by a crash is refused
+        fill_n((int*)(header + 1), n, -1);
+        header->n = n;
+        memcpy(header->magic, UF_MAGIC, sizeof(UF_MAGIC));
+    } else if (memcmp(header->magic, UF_MAGIC, sizeof(UF_MAGIC)) != 0 || header->n <= 0 || header->n > INT_MAX ||
+               size != sizeof(UF_Header) + header->n * sizeof(int)) {
+        munmap(data, size);
+        errno = EINVAL;
+        return false;
+    }
+    UF_file     = header;
+    UF_fileSize = size;
+    UF          = (int*)(header + 1);
+    atexit(UF_unmap);
+    return true;
+}
+
+// called after every union, looks at the clock once in 4096 calls
+void UF_sync() {
+    static long calls = 0;
+    static auto last  = chrono::steady_clock::now();
+    if (!UF_file || ++calls % 4096 != 0) return;
+    auto now = chrono::steady_clock::now();
+    if (now - last < UF_SYNC_PERIOD) return;
+    msync(UF_file, UF_fileSize, MS_SYNC);
+    last = now;
+}
+
+// Union-find with rollback: union by size without path compression keeps finds O(log n), and as every union
+// changes just the two roots, an undo stack can restore any earlier version
+vector<int>            RUF;          // parent/rank table like UF
+vector<pair<int, int>> RUF_history;  // linked root with its size before the link, for every union
+
+int RUF_find(int v) {
+    while (RUF[v] >= 0) v = RUF[v];
+    return v;
+}
+
+// returns whether the sets were different; version to roll back to is RUF_history.size() before the union
+bool RUF_union(int a, int b) {
+    if ((a = RUF_find(a)) == (b = RUF_find(b))) return false;
+    if (RUF[a] > RUF[b]) swap(a, b);
+    RUF_history.push_back({b, RUF[b]});
+    RUF[a] += RUF[b];
+    RUF[b] = a;
+    return true;
+}
+
+void RUF_rollback(size_t version) {
+    for (; RUF_history.size() > version; RUF_history.pop_back()) {
+        auto [b, size] = RUF_history.back();
+        RUF[RUF[b]] -= size;
+        RUF[b] = size;
+    }
+}
+
+// Union-find whose roots carry an aggregate of their set, merged in AUF_union, so that a query of the whole set
+// is a find, O(α(n)), instead of a scan of its members. T is a commutative monoid: a + b merges the aggregates of
+// two sets, in whatever order the unions come. Parent/rank and aggregate share an entry, one cache miss at root.
+template <class T>
+vector<pair<int, T>> AUF;  // parent/rank like UF, aggregate valid at roots
+
+template <class T>
+void AUF_init(const vector<T>& values) {  // singletons, each with the aggregate of its own element
+    AUF<T>.clear();
+    for (const T& value : values) AUF<T>.push_back({-1, value});
+}
+
+template <class T>
+int AUF_find(int v) {
+    auto& table = AUF<T>;
+    for (; table[v].first >= 0; v = table[v].first)
+        if (table[table[v].first].first >= 0) table[v].first = table[table[v].first].first;
+    return v;
+}
+
+template <class T>
+int AUF_union(int a, int b) {
+    auto& table = AUF<T>;
+    if ((a = AUF_find<T>(a)) == (b = AUF_find<T>(b))) return a;
+    if (table[a].first > table[b].first) swap(a, b);
+    table[a].first += table[b].first;
+    table[a].second = table[a].second + table[b].second;
+    return table[b].first = a;
+}
+
+template <class T>
+const T& AUF_aggregate(int v) { return AUF<T>[AUF_find<T>(v)].second; }
+
+// aggregate of attributes of a set: size, sum, min and max
+struct SetStats {
+    int64_t size = 0, sum = 0, min = INT64_MAX, max = INT64_MIN;
+
+    static SetStats of(int64_t value) { return {1, value, value, value}; }
+    SetStats operator+(const SetStats& other) const {
+        return {size + other.size, sum + other.sum, std::min(min, other.min), std::max(max, other.max)};
+    }
+    bool operator==(const SetStats& other) const {
+        return size == other.size && sum == other.sum && min == other.min && max == other.max;
+    }
+};
+
+// Concurrent union-find for edges ingested by many threads, with the same encoding in atomics. Roots are linked
+// with CAS of the smaller root from its size to the new parent, so it fails when the root grew or was linked
+// meanwhile. Comparing (size, index) never links two roots under each other, as sizes only grow. Size of the
+// linked set is added to the current root of the other one afterwards, so ranks are exact once threads finish.
+unique_ptr<atomic<int>[]> CUF;
+
+void CUF_init(int n) {
+    CUF.reset(new atomic<int>[n]);
+    for (int i = 0; i < n; ++i) CUF[i].store(-1, memory_order_relaxed);
+}
+
+// path halving with CAS, which fails harmlessly when another thread changed the parent first
+int CUF_find(int v) {
+    while (true) {
+        int p = CUF[v].load(memory_order_relaxed);
+        if (p < 0) return v;
+        int gp = CUF[p].load(memory_order_relaxed);
+        if (gp < 0) return p;
+        CUF[v].compare_exchange_weak(p, gp, memory_order_relaxed);
+        v = gp;
+    }
+}
+
+int CUF_union(int a, int b) {
+    while (true) {
+        if ((a = CUF_find(a)) == (b = CUF_find(b))) return a;
+        int sa = CUF[a].load(), sb = CUF[b].load();
+        if (sa >= 0 || sb >= 0) continue;                                // linked meanwhile
+        if (sa > sb || (sa == sb && a > b)) swap(a, b), swap(sa, sb);  // b is the smaller one
+        if (!CUF[b].compare_exchange_strong(sb, a)) continue;
+        for (int root = CUF_find(a);; root = CUF_find(root)) {          // a could be linked by now
+            int size = CUF[root].load();
+            if (size < 0 && CUF[root].compare_exchange_weak(size, size + sb)) return root;
+        }
+    }
+}
+
+// Union-find over sparse 64-bit IDs. IDs are interned to dense indices by an open addressing hash table, so
+// nothing is allocated up front and memory grows with the number of distinct IDs, not with their range. Dense
+// indices have their own parent/rank table with the same encoding.
+struct SUF_Slot {
+    uint32_t tag;    // high half of the hash of ID, compared before the ID itself
+    int      index;  // dense index of ID, -1 for empty slot
+};
+vector<SUF_Slot> SUF_slots;  // power of 2 sized, at most 3/4 full
+vector<uint64_t> SUF_ids;    // ID of dense index
+vector<int>      SUF;        // parent/rank table of dense indices
+
+// splitmix64 finalizer, so that IDs with regular low bits still spread over the table
+inline uint64_t SUF_hash(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// slot of id, or the empty one where it belongs
+inline SUF_Slot& SUF_slot(uint64_t id) {
+    uint64_t hash = SUF_hash(id);
+    size_t   mask = SUF_slots.size() - 1, i = hash & mask;
+    for (; SUF_slots[i].index >= 0; i = (i + 1) & mask)
+        if (SUF_slots[i].tag == uint32_t(hash >> 32) && SUF_ids[SUF_slots[i].index] == id) break;
+    return SUF_slots[i];
+}
+
+// dense index of id, -1 if it wasn't seen
+int SUF_lookup(uint64_t id) { return SUF_slots.empty() ? -1 : SUF_slot(id).index; }
+
+// dense index of id, a new singleton set for the unseen one
+int SUF_intern(uint64_t id) {
+    if (4 * (SUF_ids.size() + 1) > 3 * SUF_slots.size()) {
+        vector<SUF_Slot> old(max<size_t>(16, 2 * SUF_slots.size()), SUF_Slot{0, -1});
+        swap(old, SUF_slots);
+        for (const SUF_Slot& slot : old)
+            if (slot.index >= 0) SUF_slot(SUF_ids[slot.index]) = slot;
+    }
+    SUF_Slot& slot = SUF_slot(id);
+    if (slot.index < 0) {
+        slot = SUF_Slot{uint32_t(SUF_hash(id) >> 32), (int)SUF_ids.size()};
+        SUF_ids.push_back(id);
+        SUF.push_back(-1);
+    }
+    return slot.index;
+}
+
+int SUF_find_index(int v) {
+    for (; SUF[v] >= 0; v = SUF[v])
+        if (SUF[SUF[v]] >= 0) SUF[v] = SUF[SUF[v]];
+    return v;
+}
+
+// representant of the set of id, unseen id is a singleton and isn't stored
+uint64_t SUF_find(uint64_t id) {
+    int v = SUF_lookup(id);
+    return v < 0 ? id : SUF_ids[SUF_find_index(v)];
+}
+
+inline int SUF_rank(uint64_t id) {
+    int v = SUF_lookup(id);
+    return v < 0 ? 1 : -SUF[SUF_find_index(v)];
+}
+
+uint64_t SUF_union(uint64_t a, uint64_t b) {
+    int x = SUF_find_index(SUF_intern(a)), y = SUF_find_index(SUF_intern(b));
+    if (x != y) {
+        if (SUF[x] > SUF[y]) swap(x, y);
+        SUF[x] += SUF[y];
+        SUF[y] = x;
+    }
+    return SUF_ids[x];
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+// stdin read in large blocks and parsed in place. Commands are short, so before each word the buffer is
+// refilled to hold at least LOOKAHEAD bytes, followed by NUL, and the word is parsed without bound checks.
+struct Reader {
+    static const size_t SIZE = 1 << 20, LOOKAHEAD = 64;
+
+    char* buffer = new char[SIZE + 1];
+    char* pos    = buffer;
+    char* end    = buffer;
+    bool  eof    = false;
+
+    void fill() {
+        if (size_t(end - pos) >= LOOKAHEAD || eof) return;
+        size_t left = end - pos;
+        memmove(buffer, pos, left);
+        size_t n = fread(buffer + left, 1, SIZE - left, stdin);
+        eof      = n < SIZE - left;
+        pos = buffer, end = buffer + left + n;
+        *end = '\0';
+    }
+    static bool space(char c) { return c == ' ' || unsigned(c - '\t') < 5; }
+
+    // first character of the next word, NUL at the end of input
+    char skipSpaces() {
+        for (fill(); pos < end && space(*pos); fill()) ++pos;
+        return *pos;
+    }
+    void skipWord() {
+        for (fill(); pos < end && !space(*pos); fill()) ++pos;
+    }
+    void skipLine() {
+        for (fill(); pos < end && *pos != '\n'; fill()) ++pos;
+    }
+    uint64_t number() {
+        uint64_t x = 0;
+        for (skipSpaces(); *pos >= '0' && *pos <= '9'; ++pos) x = x * 10 + (*pos - '0');
+        return x;
+    }
+};
+
+// stdout written in large blocks
+struct Writer {
+    char   buffer[1 << 16];
+    size_t size = 0;
+
+    void number(uint64_t x) {
+        if (size + 21 > sizeof(buffer)) flush();
+        char digits[20];
+        int  length = 0;
+        do digits[length++] = '0' + x % 10; while (x /= 10);
+        while (length > 0) buffer[size++] = digits[--length];
+        buffer[size++] = '\n';
+    }
+    void text(const char* s) {
+        size_t length = strlen(s);
+        if (size + length > sizeof(buffer)) flush();
+        memcpy(buffer + size, s, length);
+        size += length;
+    }
+    void flush() {
+        fwrite(buffer, 1, size, stdout);
+        fflush(stdout);
+        size = 0;
+    }
+};
+
+// the commands of the driver, output is flushed every `flushEvery` finds (0 for the end only)
+int batch(bool sparse, long flushEvery) {
+    static Reader reader;
+    static Writer writer;
+    long          finds = 0;
+    for (char op; (op = reader.skipSpaces()) != '\0';) {
+        reader.skipWord();
+        if (op == 'u') {
+            uint64_t a = reader.number(), b = reader.number();
+            sparse ? SUF_union(a, b) : UF_union(a, b);
+            UF_sync();
+        } else if (op == 'f') {
+            uint64_t a = reader.number();
+            writer.number(sparse ? SUF_find(a) : UF_find(a));
+            if (flushEvery > 0 && ++finds % flushEvery == 0) writer.flush();
+        } else {
+            writer.text("no.\n");
+            reader.skipLine();
+        }
+    }
+    writer.flush();
+    return 0;
+}
+
+// Offline dynamic connectivity over an event log of commands
+//   + <a> <b>  adds edge
+//   - <a> <b>  removes edge (one copy of it, if it was added more times)
+//   ? <a> <b>  prints 1 if a and b are connected, 0 otherwise
+// Other lines are ignored.
+// Every edge is alive in a range of queries, which a segment tree over the queries splits into O(log q) nodes.
+// DFS of the tree unions edges of a node on entry and rolls them back on exit, so each leaf sees exactly the
+// edges alive at its query: O((n + q) log q log n) in total.
+struct OfflineQuery {
+    int a, b;
+};
+
+void offlineSolve(vector<vector<pair<int, int>>>& tree, const vector<OfflineQuery>& queries, Writer& writer,
+                  int node, int l, int r) {
+    size_t version = RUF_history.size();
+    for (auto [a, b] : tree[node]) RUF_union(a, b);
+    if (r - l == 1) {
+        writer.text(RUF_find(queries[l].a) == RUF_find(queries[l].b) ? "1\n" : "0\n");
+    } else {
+        int m = (l + r) / 2;
+        offlineSolve(tree, queries, writer, 2 * node, l, m);
+        offlineSolve(tree, queries, writer, 2 * node + 1, m, r);
+    }
+    RUF_rollback(version);
+}
+
+void offlineInsert(vector<vector<pair<int, int>>>& tree, int node, int l, int r, int from, int to,
+                   pair<int, int> edge) {
+    if (to <= l || r <= from) return;
+    if (from <= l && r <= to) return tree[node].push_back(edge);
+    int m = (l + r) / 2;
+    offlineInsert(tree, 2 * node, l, m, from, to, edge);
+    offlineInsert(tree, 2 * node + 1, m, r, from, to, edge);
+}
+
+int offline() {
+    static Reader reader;
+    static Writer writer;
+
+    struct Interval {
+        int from, to;
+        pair<int, int> edge;
+    };
+    vector<OfflineQuery>             queries;
+    vector<Interval>                 intervals;
+    map<pair<int, int>, vector<int>> added;  // first query each copy of an edge is alive in
+    int                              n = 0;
+    for (char op; (op = reader.skipSpaces()) != '\0';) {
+        reader.skipWord();
+        if (op != '+' && op != '-' && op != '?') {  // answers come at the end, so nothing to print for it
+            reader.skipLine();
+            continue;
+        }
+        int a = reader.number(), b = reader.number();
+        n     = max(n, max(a, b) + 1);
+        if (op == '?') queries.push_back({a, b});
+        auto edge = minmax(a, b);
+        if (op == '+') added[edge].push_back(queries.size());
+        if (op == '-' && !added[edge].empty()) {
+            intervals.push_back({added[edge].back(), (int)queries.size(), edge});
+            added[edge].pop_back();
+        }
+    }
+    for (auto& [edge, starts] : added)
+        for (int from : starts) intervals.push_back({from, (int)queries.size(), edge});
+
+    int q = queries.size();
+    if (q > 0) {
+        vector<vector<pair<int, int>>> tree(4 * q);
+        for (const Interval& interval : intervals) offlineInsert(tree, 1, 0, q, interval.from, interval.to, interval.edge);
+        RUF.assign(n, -1);
+        offlineSolve(tree, queries, writer, 1, 0, q);
+    }
+    writer.flush();
+    return 0;
+}
+
+// Edge list file mapped into memory. Text files have two vertices per line, lines starting with '#' or '%' are
+// comments; binary ones are pairs of native 32-bit vertices.
+struct EdgeFile {
+    const char* data = NULL;
+    size_t      size = 0;
+    bool        binary;
+
+    // offset of the first edge at or after offset, so that threads can split the file anywhere
+    size_t align(size_t offset) const {
+        if (offset >= size) return size;
+        if (binary) return min(size, (offset + 7) / 8 * 8);
+        if (offset == 0) return 0;
+        const char* line = (const char*)memchr(data + offset - 1, '\n', size - offset + 1);
+        return line ? line + 1 - data : size;
+    }
+
+    // calls f(a, b) for the edges in [from, to), both aligned, or for the first limit of them, returns the offset
+    // it stopped at
+    template <class F>
+    size_t edges(size_t from, size_t to, F&& f, int64_t limit = INT64_MAX) const {
+        if (binary) {
+            for (uint32_t edge[2]; from + 8 <= to && limit-- > 0; from += 8)
+                memcpy(edge, data + from, 8), f(edge[0], edge[1]);
+            return from;
+        }
+        const char *p = data + from, *end = data + to;
+        auto number   = [&](uint32_t& x) {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) ++p;
+            if (p == end || *p < '0' || *p > '9') return false;
+            for (x = 0; p < end && *p >= '0' && *p <= '9'; ++p) x = x * 10 + (*p - '0');
+            return true;
+        };
+        for (uint32_t a, b; p < end && limit > 0;) {
+            if (*p != '#' && *p != '%' && number(a) && number(b)) f(a, b), --limit;
+            const char* line = (const char*)memchr(p, '\n', end - p);
+            p                = line ? line + 1 : end;
+        }
+        return p - data;
+    }
+};
+
+template <class F>
+void parallel(int threads, F&& f) {
+    vector<thread> workers;
+    for (int t = 0; t < threads; ++t) workers.emplace_back(f, t);
+    for (thread& worker : workers) worker.join();
+}
+
+// points every vertex of [0, n) straight to its root
+void CUF_compress(int n, int threads) {
+    parallel(threads, [&](int t) {
+        for (int v = (int64_t)n * t / threads; v < (int64_t)n * (t + 1) / threads; ++v) {
+            int root = CUF_find(v);
+            if (root != v) CUF[v].store(root, memory_order_relaxed);
+        }
+    });
+}
+
+// Edges of [from, to) with both ends below n, or the first limit ones, passed to link(a, b) in batches. Parents
+// of both ends are prefetched some edges ahead, as with the table larger than cache the unions wait on memory
+// rather than on parsing. Returns the offset it stopped at.
+const int COMPONENTS_BATCH = 256, COMPONENTS_PREFETCH = 16;
+
+template <class F>
+size_t linkEdges(const EdgeFile& file, size_t from, size_t to, int64_t n, F&& link, int64_t limit = INT64_MAX) {
+    pair<uint32_t, uint32_t> batch[COMPONENTS_BATCH];
+    int                      size  = 0;
+    auto                     flush = [&] {
+        for (int i = 0; i < size; ++i) {
+            if (i + COMPONENTS_PREFETCH < size) {
+                __builtin_prefetch(&CUF[batch[i + COMPONENTS_PREFETCH].first]);
+                __builtin_prefetch(&CUF[batch[i + COMPONENTS_PREFETCH].second]);
+            }
+            link(batch[i].first, batch[i].second);
+        }
+        size = 0;
+    };
+    size_t end = file.edges(from, to, [&](uint32_t a, uint32_t b) {
+        if (a < n && b < n) batch[size++] = {a, b};
+        if (size == COMPONENTS_BATCH) flush();
+    }, limit);
+    flush();
+    return end;
+}
+
+void appendNumber(string& out, uint64_t x, char separator) {
+    char digits[24], *end = to_chars(digits, digits + 20, x).ptr;
+    *end++                = separator;
+    out.append(digits, end);
+}
+
+const int COMPONENTS_SAMPLE = 2;  // edges per vertex on average linked before the largest component is looked for
+
+// Connected components of an edge list file in parallel, `./unionFind components [-b] [-n N] FILE [threads]`,
+// -b for a binary file. Vertices are [0, N), N is the largest vertex + 1 unless given, which saves a pass over
+// the file; larger vertices are ignored. The file is mapped and split between threads, which link their edges
+// in CUF like Afforest: a sample of 2N edges first, then the table is compressed so that most vertices point
+// straight to their root, and of the remaining edges those inside the largest component, found by sampling
+// vertices, are skipped with two loads instead of two finds. Unlike Afforest, which takes the first 2 edges of
+// every vertex, the sample is the first 2N / threads edges of every part of the file, by position: enough for
+// the giant component to emerge if edges are in random order, but on a list sorted by vertex it covers only
+// the neighbourhoods of the first vertices of each part, so that the skip can apply to few edges. Results
+// don't depend on it.
+// Output is "N components", the label (root) of every vertex per line, then "label size" of every component
+// from the largest one.
+int components(int argc, char* argv[]) {
+    EdgeFile    file;
+    const char* path    = NULL;
+    int64_t     n       = 0;
+    int         threads = max(1u, thread::hardware_concurrency());
+    file.binary         = false;
+    for (int i = 0; i < argc; ++i) {
+        if (string(argv[i]) == "-b") file.binary = true;
+        else if (string(argv[i]) == "-n" && i + 1 < argc) n = atoll(argv[++i]);
+        else if (!path) path = argv[i];
+        else threads = max(1, atoi(argv[i]));
+    }
+    if (!path) {
+        fprintf(stderr, "usage: unionFind components [-b] [-n N] FILE [threads]\n");
+        return 1;
+    }
+    int         fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) return perror(path), 1;
+    if ((file.size = st.st_size) > 0) {
+        void* data = mmap(NULL, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) return perror(path), 1;
+        madvise(data, file.size, MADV_SEQUENTIAL);
+        file.data = (const char*)data;
+    }
+    close(fd);
+
+    // part t of the file is [bounds[t], bounds[t + 1]), its sample the first edges [bounds[t], samples[t])
+    vector<size_t> bounds(threads + 1), samples(threads);
+    for (int t = 0; t < threads; ++t) bounds[t] = file.align(file.size / threads * t);
+    bounds[threads] = file.size;
+
+    auto start = chrono::steady_clock::now();
+    if (n == 0) {
+        vector<int64_t> largest(threads);
+        parallel(threads, [&](int t) {
+            int64_t top = 0;
+            file.edges(bounds[t], bounds[t + 1], [&](uint32_t a, uint32_t b) { top = max<int64_t>(top, max(a, b) + 1ll); });
+            largest[t] = top;
+        });
+        n = *max_element(largest.begin(), largest.end());
+    }
+    if (n > INT_MAX) {
+        fprintf(stderr, "%s: %lld vertices don't fit the table\n", path, (long long)n);
+        return 1;
+    }
+    CUF_init(n);
+
+    parallel(threads, [&](int t) {
+        samples[t] = linkEdges(file, bounds[t], bounds[t + 1], n, CUF_union, COMPONENTS_SAMPLE * n / threads);
+    });
+    CUF_compress(n, threads);
+
+    int largest = 0;
+    if (n > 0) {
+        mt19937       random(7);
+        map<int, int> count;
+        for (int i = 0; i < 1024; ++i) {
+            int root = CUF_find(random() % n);
+            if (++count[root] > count[largest]) largest = root;
+        }
+    }
+    auto parent = [&](uint32_t v) {
+        int p = CUF[v].load(memory_order_relaxed);
+        return p < 0 ? (int)v : p;
+    };
+    parallel(threads, [&](int t) {
+        linkEdges(file, samples[t], bounds[t + 1], n, [&](uint32_t a, uint32_t b) {
+            if (parent(a) != largest || parent(b) != largest) CUF_union(a, b);
+        });
+    });
+    CUF_compress(n, threads);
+    double linking = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    vector<pair<int, int>> sizes;  // (size, label)
+    for (int v = 0; v < n; ++v)
+        if (int size = CUF[v].load(memory_order_relaxed); size < 0) sizes.push_back({-size, v});
+    sort(sizes.begin(), sizes.end(), [](pair<int, int> x, pair<int, int> y) { return x.first > y.first; });
+
+    // labels are formatted by threads in blocks of BLOCK vertices each, written in order
+    const int      BLOCK = 1 << 16;
+    vector<string> parts(threads);
+    printf("%lld %zu\n", (long long)n, sizes.size());
+    for (int64_t from = 0; from < n; from += (int64_t)BLOCK * threads) {
+        parallel(threads, [&](int t) {
+            parts[t].clear();
+            for (int64_t v = from + (int64_t)BLOCK * t; v < min(n, from + (int64_t)BLOCK * (t + 1)); ++v)
+                appendNumber(parts[t], parent(v), '\n');
+        });
+        for (string& part : parts) fwrite(part.data(), 1, part.size(), stdout);
+    }
+    string out;
+    for (auto [size, label] : sizes) {
+        appendNumber(out, label, ' '), appendNumber(out, size, '\n');
+        if (out.size() >= 1 << 16) fwrite(out.data(), 1, out.size(), stdout), out.clear();
+    }
+    fwrite(out.data(), 1, out.size(), stdout);
+    fflush(stdout);
+    fprintf(stderr, "%lld vertices, %zu components, largest %d, linked in %.3fs by %d threads\n", (long long)n,
+            sizes.size(), sizes.empty() ? 0 : sizes[0].first, linking, threads);
+    return 0;
+}
+
+template <class F>
+double seconds(F&& f) {
+    auto start = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// random unions followed by random finds, then the finds of union by size worst case: binomial trees of depth
+// log n built by unions of equal roots, queried from every node. At last a chain of all nodes, as if linked
+// without the size heuristic, found from its end -- in a child process, as recursion runs out of stack.
+template <int (*find)(int)>
+void benchFind(const char* name, int n) {
+    mt19937 random(7);
+    UF_init(n);
+    double unions = seconds([&] { for (int i = 0; i < n; ++i) UF_union<find>(random() % n, random() % n); });
+    double finds  = seconds([&] { for (int i = 0; i < n; ++i) find(random() % n); });
+    printf("%-10s random:   %d unions %.3fs, %d finds %.3fs\n", name, n, unions, n, finds);
+
+    UF_init(n);
+    for (int step = 1; step < n; step *= 2)
+        for (int i = 0; i + step < n; i += 2 * step) UF_union<find>(i, i + step);
+    finds = seconds([&] { for (int i = n - 1; i >= 0; --i) find(i); });
+    printf("%-10s binomial: %d finds %.3fs\n", name, n, finds);
+
+    for (int i = 0; i < n; ++i) UF[i] = i + 1;
+    UF[n - 1] = -n;
+    fflush(stdout);
+    if (fork() == 0) {
+        finds = seconds([&] { for (int i = 0; i < n; ++i) find(i); });
+        printf("%-10s chain:    %d finds %.3fs\n", name, n, finds);
+        exit(0);
+    }
+    int status;
+    wait(&status);
+    if (WIFSIGNALED(status)) printf("%-10s chain:    crashed with signal %d\n", name, WTERMSIG(status));
+}
+
+// i-th edge of the random graph, the same for any thread reading it
+pair<int, int> randomEdge(uint64_t i, int n) {
+    uint64_t x = (i + 1) * 0x9E3779B97F4A7C15ull;  // splitmix64
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return {int((x & 0xffffffff) % n), int((x >> 32) % n)};
+}
+
+// ingests m random edges by sequential UF_union and by CUF_union in threads, checks they give the same sets
+int benchConcurrent(int n, int64_t m, int threads) {
+    UF_init(n);
+    double sequential = seconds([&] {
+        for (int64_t i = 0; i < m; ++i) {
+            auto [a, b] = randomEdge(i, n);
+            UF_union(a, b);
+        }
+    });
+    printf("sequential: %lld edges %.3fs, %.1fM edges/s\n", (long long)m, sequential, m / sequential / 1e6);
+
+    CUF_init(n);
+    double concurrent = seconds([&] {
+        vector<thread> workers;
+        for (int t = 0; t < threads; ++t)
+            workers.emplace_back([&, t] {
+                for (int64_t i = m * t / threads; i < m * (t + 1) / threads; ++i) {
+                    auto [a, b] = randomEdge(i, n);
+                    CUF_union(a, b);
+                }
+            });
+        for (thread& worker : workers) worker.join();
+    });
+    printf("concurrent: %lld edges %.3fs, %.1fM edges/s in %d threads\n", (long long)m, concurrent,
+           m / concurrent / 1e6, threads);
+
+    vector<int> same(n, -1);  // root of concurrent set for the root of the sequential one
+    for (int v = 0; v < n; ++v) {
+        int root = UF_find(v), other = CUF_find(v);
+        if (same[root] < 0) same[root] = other;
+        if (same[root] != other || UF_rank(root) != -CUF[other].load()) {
+            printf("concurrent sets differ at %d\n", v);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// random unions over n of 64-bit IDs, then finds; memory is of the tables only
+void benchSparse(int n) {
+    mt19937_64 random(7);
+    vector<uint64_t> ids(n);
+    for (uint64_t& id : ids) id = random();
+    double unions = seconds([&] { for (int i = 0; i < n; ++i) SUF_union(ids[random() % n], ids[random() % n]); });
+    double finds  = seconds([&] { for (int i = 0; i < n; ++i) SUF_find(ids[random() % n]); });
+    size_t bytes  = SUF_slots.capacity() * sizeof(SUF_Slot) + SUF_ids.capacity() * 8 + SUF.capacity() * 4;
+    printf("sparse:     %zu IDs, %d unions %.3fs, %d finds %.3fs, %.1f MB\n", SUF_ids.size(), n, unions, n, finds,
+           bytes / 1e6);
+}
+
+// random unions with SetStats of random values, then random queries, checked against a scan of all members
+int benchAggregate(int n) {
+    mt19937          random(7);
+    vector<SetStats> values(n);
+    for (SetStats& value : values) value = SetStats::of(random() % 1000000);
+    AUF_init(values);
+    double unions = seconds([&] { for (int i = 0; i < n; ++i) AUF_union<SetStats>(random() % n, random() % n); });
+    uint64_t checksum = 0;  // keeps the queries from being optimized out
+    double   queries  = seconds([&] {
+        for (int i = 0; i < n; ++i) checksum += AUF_aggregate<SetStats>(random() % n).sum;
+    });
+    printf("aggregate:  %d unions %.3fs, %d queries %.3fs (checksum %llu)\n", n, unions, n, queries,
+           (unsigned long long)checksum);
+
+    map<int, SetStats> scanned;
+    for (int v = 0; v < n; ++v) scanned[AUF_find<SetStats>(v)] = scanned[AUF_find<SetStats>(v)] + values[v];
+    for (auto& [root, stats] : scanned)
+        if (!(stats == AUF_aggregate<SetStats>(root))) {
+            printf("aggregate of %d differs from its members\n", root);
+            return 1;
+        }
+    return 0;
+}
+
+int bench(const string& name, int threads) {
+    int n = 10000000;
+    if (name.empty() || name == "find") {
+        benchFind<UF_find_recursive>("recursive", n);
+        benchFind<UF_find_halving>("halving", n);
+    }
+    if ((name.empty() || name == "concurrent") && benchConcurrent(n, 2 * n, threads) != 0) return 1;
+    if (name.empty() || name == "sparse") benchSparse(n);
+    if ((name.empty() || name == "aggregate") && benchAggregate(n) != 0) return 1;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]) == "bench")
+        return bench(argc > 2 ? argv[2] : "", argc > 3 ? atoi(argv[3]) : max(1u, thread::hardware_concurrency()));
+
+    if (argc > 1 && string(argv[1]) == "offline") return offline();
+    if (argc > 1 && string(argv[1]) == "components") return components(argc - 2, argv + 2);
+
+    int  arg    = 1;
+    bool sparse = arg < argc && string(argv[arg]) == "sparse" && ++arg;
+    if (!sparse && arg + 1 < argc && string(argv[arg]) == "checkpoint") {
+        if (!UF_map(argv[arg + 1], 10000007)) return perror(argv[arg + 1]), 1;
+        arg += 2;
+    } else if (!sparse) {
+        UF_init(10000007);
+    }
+    if (arg < argc && string(argv[arg]) == "batch") return batch(sparse, arg + 1 < argc ? atol(argv[arg + 1]) : 0);
+
     string line, op;
     while (getline(cin, line)) {
         stringstream ss(line);
         ss >> op;
 
         if (op[0] == 'u') {
-            int a, b;
+            uint64_t a, b;
             ss >> a >> b;
-            UF_union(a, b);
+            sparse ? SUF_union(a, b) : UF_union(a, b);
+            UF_sync();
         } else if (op[0] == 'f') {
-            int a;
+            uint64_t a;
             ss >> a;
-            cout << UF_find(a) << endl;
+            cout << (sparse ? SUF_find(a) : UF_find(a)) << endl;
         } else {
             cout << "no." << endl;
         }
     }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,220 @@
+// Throughput benchmark of the formatter executable: generates deterministic corpora, runs the binary
+// over each one and reports MB/s and peak RSS against the stored baseline.
+//
+//     bench [-b BINARY] [-s SIZE_MB] [-r RUNS] [-t PERCENT] [-o BASELINE_OUT] [BASELINE]
+//
+// Every corpus is fed through stdin with output to /dev/null; the best of RUNS is reported. Throughput
+// more than PERCENT (10) below the baseline is a regression and fails the benchmark. -o writes the
+// results as a new baseline.
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// xorshift, so that corpora are the same on every platform
+struct Random {
+    uint64_t state;
+
+    uint64_t operator()() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+    size_t below(size_t n) { return (*this)() % n; }
+    template <size_t N>
+    const char* pick(const char* const (&items)[N]) { return items[below(N)]; }
+};
+
+const char* const WORDS[]   = {"lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit",
+                               "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore", "et"};
+const char* const FORMATS[] = {"r", "G*", "b_", "Yk", ";m/", "%", "c.~", "#", "0", "", "w=", "R;!"};
+const char* const UTF8[]    = {"你好", "世界", "∮ E⋅da = Q", "n → ∞", "∀x∈ℝ", "⌈x⌉ = −⌊−x⌋", "α ∧ ¬β",
+                               "Καλημέρα", "κόσμε", "ｺﾝﾆﾁﾊ", "🙂"};
+const char* const ESCAPES[] = {"\\n", "\\t", "\\\\", "\\r", "\\a", "\\q", "\\v", "\\b", "\\f"};
+
+struct Corpus {
+    const char* name;
+    const char* flags;  // extra option for the formatter, or NULL
+    void (*generate)(string& out, Random& random, size_t size);
+};
+
+void words(string& out, Random& random, size_t count) {
+    for (size_t i = 0; i < count; ++i) out += random.pick(WORDS), out += random.below(12) ? ' ' : '\n';
+}
+
+const Corpus CORPORA[] = {
+    {"plain", NULL, [](string& out, Random& random, size_t size) {
+         while (out.size() < size) words(out, random, 64);
+     }},
+    {"tag-dense", NULL, [](string& out, Random& random, size_t size) {
+         while (out.size() < size) {
+             out += '{', out += random.pick(FORMATS), out += "--", out += random.pick(WORDS), out += "--}";
+             out += random.below(8) ? ' ' : '\n';
+         }
+     }},
+    {"dashes", NULL, [](string& out, Random& random, size_t size) {  // worst case of the regex parser
+         const char* const dashes[] = {"--", "---", "-- -", "{r-", "{--", "--}", "- -", "{-"};
+         while (out.size() < size) {
+             out += random.pick(dashes);
+             if (!random.below(16)) out += '\n';
+         }
+     }},
+    {"nesting", NULL, [](string& out, Random& random, size_t size) {
+         while (out.size() < size) {
+             size_t depth = 1000 + random.below(9000);
+             for (size_t i = 0; i < depth; ++i) out += '{', out += random.pick(FORMATS), out += "--x";
+             for (size_t i = 0; i < depth; ++i) out += "y--}";
+             out += '\n';
+         }
+     }},
+    {"trim", NULL, [](string& out, Random& random, size_t size) {  // huge paddings inside TRIM
+         while (out.size() < size) {
+             out += "{#--";
+             for (size_t i = random.below(1 << 20); i > 0; --i) out += " \n\t"[random.below(3)];
+             words(out, random, 8);
+             for (size_t i = random.below(1 << 20); i > 0; --i) out += " \n"[random.below(2)];
+             out += "--}\n";
+         }
+     }},
+    {"utf8", NULL, [](string& out, Random& random, size_t size) {
+         while (out.size() < size) {
+             if (random.below(4)) out += random.pick(UTF8);
+             else out += '{', out += random.pick(FORMATS), out += "--", out += random.pick(UTF8), out += "--}";
+             out += random.below(10) ? ' ' : '\n';
+         }
+     }},
+    {"escapes", "-e", [](string& out, Random& random, size_t size) {
+         while (out.size() < size) {
+             out += random.pick(ESCAPES);
+             if (!random.below(4)) out += random.pick(WORDS);
+         }
+     }},
+};
+
+struct Result {
+    double mbps;
+    long   rssKB;
+};
+
+// runs binary with input from file, returns wall time in seconds and peak RSS of the child
+bool run(const char* binary, const char* flags, const char* input, double& seconds, long& rssKB) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, input, O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    char* args[] = {(char*)binary, (char*)flags, NULL};
+
+    auto  start = chrono::steady_clock::now();
+    pid_t pid;
+    int   error = posix_spawn(&pid, binary, &actions, NULL, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+
+    int           status;
+    struct rusage usage;
+    if (error != 0 || wait4(pid, &status, 0, &usage) < 0) return false;
+    seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    rssKB   = usage.ru_maxrss;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    const char* binary = "./formatter";
+    const char* save   = NULL;
+    size_t      sizeMB = 8;
+    int         runs   = 5, opt;
+    double      margin = 10;
+    while ((opt = getopt(argc, argv, "b:s:r:t:o:")) != -1) {
+        switch (opt) {
+            case 'b': binary = optarg; break;
+            case 's': sizeMB = atoi(optarg); break;
+            case 'r': runs = max(1, atoi(optarg)); break;
+            case 't': margin = atof(optarg); break;
+            case 'o': save = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-b binary] [-s size_mb] [-r runs] [-t percent] [-o baseline_out] [baseline]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    map<string, Result> baseline;
+    if (optind < argc) {
+        if (FILE* file = fopen(argv[optind], "r")) {
+            char   name[64];
+            Result result;
+            while (fscanf(file, "%63s %lf %ld", name, &result.mbps, &result.rssKB) == 3) baseline[name] = result;
+            fclose(file);
+        }
+    }
+
+    char path[] = "/tmp/formatter-bench-XXXXXX";
+    int  fd     = mkstemp(path);
+    if (fd < 0) return perror(path), EXIT_FAILURE;
+    close(fd);
+
+    FILE* out        = save ? fopen(save, "w") : NULL;
+    bool  regression = false;
+    printf("%-10s %10s %10s %8s %12s %12s\n", "corpus", "MB/s", "baseline", "change", "peak RSS KB", "baseline");
+    for (const Corpus& corpus : CORPORA) {
+        // generated in a child, as peak RSS of the benchmark would be inherited by the measured binary
+        if (fork() == 0) {
+            string input;
+            Random random{0x9E3779B97F4A7C15ull};
+            input.reserve(sizeMB << 20);
+            corpus.generate(input, random, sizeMB << 20);
+            FILE* file = fopen(path, "w");
+            fwrite(input.data(), 1, input.size(), file);
+            _exit(fclose(file) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+        int         status;
+        struct stat st;
+        if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || stat(path, &st) < 0) {
+            fprintf(stderr, "%s: can't generate corpus\n", corpus.name);
+            unlink(path);
+            return EXIT_FAILURE;
+        }
+        size_t size = st.st_size;
+
+        double best = 1e300, seconds;
+        long   rssKB = 0, rss;
+        for (int i = 0; i < runs; ++i) {
+            if (!run(binary, corpus.flags, path, seconds, rss)) {
+                fprintf(stderr, "%s: %s failed\n", corpus.name, binary);
+                unlink(path);
+                return EXIT_FAILURE;
+            }
+            best = min(best, seconds), rssKB = max(rssKB, rss);
+        }
+        Result result{size / best / 1e6, rssKB};
+        if (out) fprintf(out, "%s %.2f %ld\n", corpus.name, result.mbps, result.rssKB);
+
+        auto it = baseline.find(corpus.name);
+        if (it == baseline.end()) {
+            printf("%-10s %10.2f %10s %8s %12ld %12s\n", corpus.name, result.mbps, "-", "-", result.rssKB, "-");
+            continue;
+        }
+        double change = (result.mbps / it->second.mbps - 1) * 100;
+        bool   slower = change < -margin;
+        regression |= slower;
+        printf("%-10s %10.2f %10.2f %+7.1f%% %12ld %12ld%s\n", corpus.name, result.mbps, it->second.mbps, change,
+               result.rssKB, it->second.rssKB, slower ? "  REGRESSION" : "");
+    }
+    unlink(path);
+    if (out) fclose(out);
+    return regression ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,15 +1,26 @@
+#include <fcntl.h>
 #include <getopt.h>  // unistd might not work
+#include <stdio_ext.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
-#include <cassert>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
 #include <cstdio>
-#include <regex>
-#include <sstream>
-#include <stack>
+#include <cstring>
+#include <mutex>
 #include <string>
-#include <vector>
+
+#include "formatter.hpp"
 
 using namespace std;
+using namespace formatter;
 
 const char* USAGE  = R"-(
 Usage: %s [options] [strings...]
@@ -30,6 +41,28 @@ Options:
     -s --strip              strip off formatting sequences (tags)
     -e --escape             escape sequences (\[\abrnftv])
     -S --no-sanitize        don't insert format-reset on EOF
+    -p --pipeline           read, format and write STDIN in separate threads,
+                            faster between a fast producer and slow consumer
+    -b --batch              format arguments with one automaton and print them
+                            with one write, without format resets in between
+    -0 --null               read NUL-terminated records from STDIN and format
+                            each one as an argument, terminated with NUL
+    -c --coalesce           merge consecutive ANSI SGR sequences (of input and
+                            formatting) into one, dropping redundant ones
+    -T --tags "O S C"       use delimiters O, S and C for tags 'O<format>S' and
+                            'C' instead of '{', '--' and '--}', e.g. "<< :: >>"
+    -t --tee PATH           also write stripped output to PATH, as with -s,
+                            in the same pass
+    -f --file               arguments are paths of files to format, each
+                            one as a separate input
+    -j --jobs N             format input in chunks by N threads, all cores if
+                            N is 0. Output is the same as without -j
+       --chunk BYTES        input per chunk with -j, 1 MiB by default and
+                            less for smaller files to split them evenly
+       --stats              print stats of formatting to STDERR on exit
+       --serve SOCKET       format requests from clients of unix socket at
+                            SOCKET path with the options given to the server
+       --connect SOCKET     format args or input by the server at SOCKET
        --demo               show demo
     -h --help               displays this help
 
@@ -49,9 +82,8 @@ Overview:
 
     Strip option is useful when you have to preserve a file that you want to
     display later with colors, but also need to get rid of all formatting
-    characters. For now tags are hardcoded, which poses danger to files that
-    have {-- and --} as content. In the future there will be an option to
-    provide custom tags
+    characters. When input has {-- and --} as content, custom delimiters can
+    be set with -T.
 
 Formatting and examples:
     TL;DR legend of formats and how it works is available under '-l' option.
@@ -187,335 +219,577 @@ const char* DEMO = R"-(
 )-";
 
 
-/*
-format bitmask:     ┃ valid|0|# ┃ .|~|=|^|_|/|*|!|% ┃          ┃ light bg|bg ┃ light fg|fg ┃
-bit widths:     MSB ┃   1  |1|1 ┃ 1|1|1|1|1|1|1|1|1 ┃          ┃    1    | 4 ┃    1    | 4 ┃ LSB
-                    ┃  ctrl(3b) ┃    fmt(9b)        ┃ pad(10b) ┃     bg(5b)  ┃     fg(5b)  ┃
-*/
-
-typedef __uint32_t mask_t;
-
-enum Masks {
-    //-COLOR-MASKS----------
-    FG_LIGHT = 0x10 << 0,            // mask light bit of fg
-    FG_COLOR = 0x0f << 0,            // mask for color code of fg
-    FG_MASK  = FG_LIGHT | FG_COLOR,  // mask for whole FG of
-    BG_LIGHT = FG_LIGHT << 5,
-    BG_COLOR = FG_COLOR << 5,
-    BG_MASK  = BG_LIGHT | BG_COLOR,  // mask for all BG
-
-    BLACK   = 0,  // ANSI color base +0
-    RED     = 1,
-    GREEN   = 2,
-    YELLOW  = 3,
-    BLUE    = 4,
-    MAGENTA = 5,
-    CYAN    = 6,
-    WHITE   = 7,
-
-    //-COLOR-SPECIAL--------
-    DEFAULT_COLOR = 9,   // 0b1001  default terminal color: ANSI color base +9
-    CURRENT_COLOR = 10,  // 0b1010  means that last used color should be used.
-
-    //-FORMAT---------------
-    FORMAT_MASK = 0x1ff << 20,
-
-    REVERSED         = 1 << 20,
-    BLINK            = 1 << 21,
-    BOLD             = 1 << 22,
-    ITALIC           = 1 << 23,
-    UNDERLINE        = 1 << 24,
-    OVERLINE         = 1 << 25,
-    DOUBLE_UNDERLINE = 1 << 26,
-    STRIKETHROUGH    = 1 << 27,
-    DIM              = 1 << 28,
-
-    //-CONTROL--------------
-    TRIM  = 1 << 29,
-    RESET = 1 << 30,
-    VALID = 1 << 31,
-
-    //-SPECIAL-MASKS--------
-    INITIAL_FORMAT_MASK = VALID | RESET | DEFAULT_COLOR << 5 | DEFAULT_COLOR,
-    EMPTY_FORMAT_MASK   = VALID | CURRENT_COLOR << 5 | CURRENT_COLOR,
-};
 
-const string formatChars =
-    "krgybmcw"      // 0-7
-    "-"             // 8
-    "d;"            // 9-10
-    "KRGYBMCW"      // 11-18
-    "%!*/_^=~.#0";  // 19-29
-
-#define GET_FG(mask) (((mask)&FG_COLOR) >> 0)                                             // returns FG on LSBits
-#define GET_BG(mask) (((mask)&BG_COLOR) >> 5)                                             // returns BG on LSBits
-#define LIGHTER(color) ((color) | (1 << 4))                                               // returns lighter color mask
-#define MASK_TO_FG_ANSI(mask) (GET_FG(mask) + 30 + ((mask)&FG_LIGHT ? 60 : 0))            // returns ANSI code for fg color
-#define MASK_TO_BG_ANSI(mask) (GET_BG(mask) + 40 + ((mask)&BG_LIGHT ? 60 : 0))            // returns ANSI code for bg color
-#define OVERRIDE(target, submask, source) ((target) & ~(submask) | (source) & (submask))  // returns mask with submask from other
-// returns mask with set primary(part=0) or secondary(part!=0) color
-inline mask_t WITH_COLOR(mask_t mask, int color, int part) {
-    return OVERRIDE(mask, (part == 0 ? FG_MASK : BG_MASK), color | color << 5);
-}
+static int f_strip;
+static int f_escape;
+static int f_no_sanitize;
+static int f_file;
+static int f_jobs = 1;
+static size_t f_chunk;  // 0 for the default
+static FILE* teeFile;
+static int f_stats;
+static int f_pipeline;
+static int f_batch;
+static int f_null;
+static int f_coalesce;
+static FILE* outstream = stdout;  // formatted output
+static Delimiters delimiters = DEFAULT_DELIMITERS;
 
-class FormatterAutomaton {
-    const bool strip    = false;    // should strip instead of printing ANSI
-    const bool escape   = false;    // should escape special characters
-    const bool sanitize = true;     // should print format reset in destructor
+static struct option longOptions[] = {
+    {"help",        no_argument, NULL,              'h'},
+    {"version",     no_argument, NULL,              'v'},
+    {"legend",      no_argument, NULL,              'l'},
+    {"strip",       no_argument, &f_strip,          's'},
+    {"escape",      no_argument, &f_escape,         'e'},
+    {"no-sanitize", no_argument, &f_no_sanitize,    'S'},
+    {"file",        no_argument, &f_file,           'f'},
+    {"jobs",  required_argument, NULL,              'j'},
+    {"tee",   required_argument, NULL,              't'},
+    {"tags",  required_argument, NULL,              'T'},
+    {"pipeline",    no_argument, &f_pipeline,       'p'},
+    {"batch",       no_argument, &f_batch,          'b'},
+    {"null",        no_argument, &f_null,           '0'},
+    {"coalesce",    no_argument, &f_coalesce,       'c'},
+    {"stats",       no_argument, &f_stats,           1 },
+    {"serve", required_argument, NULL,               0 },
+    {"connect", required_argument, NULL,             0 },
+    {"chunk",   required_argument, NULL,             0 },
+    {"demo"       , no_argument, NULL,               0 },
+    {NULL,          0,           NULL,               0 },
+};
 
-    enum STATE {
-        DEFAULT_STATE,
-        PARSE_ESCAPE_STATE,
-        PARSE_OPENING_BRACKET_STATE,
-        SKIP_LEADING_PADDING_STATE,
-    } state = DEFAULT_STATE;
+using Clock = chrono::steady_clock;
 
-    string        store            = "";               // stores current buffered input if processing potential parts
-    stack<mask_t> formatStack      = stack<mask_t>();  // mask always describes active formatting (absolute format)
-    mask_t        bracketMask      = EMPTY_FORMAT_MASK;
-    int           parsedColorParts = 0;
+static Stats          stats;           // of all inputs
+static size_t         bytesOut;        // written to stdout
+static Clock::duration outputTime{};   // spent writing output, the rest of formatting is parsing
 
-#pragma region innards
+// file sink with the optional stages of command line: SGR coalescing and measuring output for --stats
+struct OutputSink {
+    FileSink     sink;
+    bool         counted;  // is formatted output, not tee
+    SgrCoalescer coalescer;
 
-    void printANSI(string ANSI) {
-        if (!strip)
-            printf("%s", ANSI.c_str());
+    void write(const char* data, size_t size) {
+        if (!f_stats) return sink(data, size);
+        auto start = Clock::now();
+        sink(data, size);
+        outputTime += Clock::now() - start;
+        if (counted) bytesOut += size;
     }
 
-    // converts absolute format mask to ANSI string that can be printed
-    string formatToAnsi(mask_t format) {
-        assert(format & VALID && format & RESET);
-
-        vector<int> codes;
-        // ANSI VALUES
-        if (format & RESET) codes.push_back(0);
-        if (format & BOLD) codes.push_back(1);
-        if (format & DIM) codes.push_back(2);
-        if (format & ITALIC) codes.push_back(3);
-        if (format & UNDERLINE) codes.push_back(4);
-        if (format & BLINK) codes.push_back(6);
-        if (format & REVERSED) codes.push_back(7);
-        if (format & STRIKETHROUGH) codes.push_back(9);
-        if (format & DOUBLE_UNDERLINE) codes.push_back(21);
-        if (format & OVERLINE) codes.push_back(53);
-        codes.push_back(MASK_TO_FG_ANSI(format));
-        codes.push_back(MASK_TO_BG_ANSI(format));
-        string ANSI = "";
-        for (int code : codes) ANSI += ";" + to_string(code);
-        assert(ANSI.size() > 0);
-        return "\e[" + ANSI.substr(1) + "m";
+    void operator()(const char* data, size_t size) {
+        auto written = [this](const char* data, size_t size) { write(data, size); };
+        f_coalesce ? coalescer.write(written, data, size) : write(data, size);
     }
 
-    // pushes format on stack and returns built ANSI escape sequence
-    string pushFormat(mask_t mask) {
-        assert(mask & VALID);
-
-        mask_t format = formatStack.top();
+    ~OutputSink() {
+        auto written = [this](const char* data, size_t size) { write(data, size); };
+        if (f_coalesce) coalescer.flush(written);
+        auto start = Clock::now();
+        sink.flush();
+        outputTime += Clock::now() - start;
+    }
+};
 
-        // 1. calculate the absolute format
-        if (mask & RESET) format = INITIAL_FORMAT_MASK;                               // RESET to base off default mask
-        format = OVERRIDE(format, TRIM, mask);                                        // trim doesn't propagate through stack
-        format ^= mask & FORMAT_MASK;                                                 // toggle the formatting specified in `mask`
-        if (GET_FG(mask) != CURRENT_COLOR) format = OVERRIDE(format, FG_MASK, mask);  // override fg color from mask
-        if (GET_BG(mask) != CURRENT_COLOR) format = OVERRIDE(format, BG_MASK, mask);  // override bg color from mask
+// calls f(sink, strip, escape, sanitize) with stdout sink, teeing stripped output to file if requested
+template <class F>
+void withCommandLine(size_t buffering, F&& f) {
+    auto withSinks = [&](auto wrap) {
+        withOptions(f_strip, f_escape, !f_no_sanitize, [&](auto strip, auto escape, auto sanitize) {
+            if (teeFile) {
+                TeeSink<decltype(wrap(outstream)), decltype(wrap(teeFile))> out{wrap(outstream), wrap(teeFile)};
+                f(out, strip, escape, sanitize);
+            } else {
+                auto out = wrap(outstream);
+                f(out, strip, escape, sanitize);
+            }
+        });
+    };
+    if (f_stats || f_coalesce)
+        withSinks([&](FILE* file) { return OutputSink{FileSink(file, buffering), file == outstream, {}}; });
+    else withSinks([&](FILE* file) { return FileSink(file, buffering); });
+}
 
-        // 2. store absolute format
-        formatStack.push(format);
+// prints stats to stderr on one line of key=value pairs
+void printStats(Clock::duration total) {
+    double seconds = chrono::duration<double>(total).count();
+    double output  = chrono::duration<double>(outputTime).count();
+    fprintf(stderr,
+            "bytes_in=%zu bytes_out=%zu tags_opening=%zu tags_closing=%zu tags_rejected=%zu ansi=%zu "
+            "escapes=%zu max_depth=%zu store_max=%zu store_bytes_max=%zu parse_s=%.6f output_s=%.6f "
+            "mb_per_s=%.2f\n",
+            stats.bytesIn, bytesOut, stats.openingTags, stats.closingTags, stats.rejectedTags, stats.ansi,
+            stats.escapes, stats.maxDepth, stats.maxStore, stats.maxStoreBytes, seconds - output, output,
+            seconds > 0 ? stats.bytesIn / seconds / 1e6 : 0.0);
+}
 
-        // 3. build ansi sequence from absolute mask
-        return formatToAnsi(format);
+bool writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n, size -= n;
     }
+    return true;
+}
 
-    // pops format from stack and returns built ANSI escape sequence
-    string popFormat() {
-        if (formatStack.size() > 1) formatStack.pop();
-        return formatToAnsi(formatStack.top());  // restore previous format
+// Lock-free single-producer single-consumer ring of bytes. Both sides only spin on the indices,
+// a side that has to wait yields first and then sleeps on the condition variable, woken by the other
+// side or by timeout, which bounds the latency of a missed wakeup.
+class Ring {
+    vector<char>                 data;
+    const size_t                 mask;
+    alignas(64) atomic<size_t>   head{0};  // written by producer
+    alignas(64) atomic<size_t>   tail{0};  // written by consumer
+    alignas(64) atomic<bool>     closed{false};
+    atomic<bool>                 sleeping{false};
+    mutex                        lock;
+    condition_variable           wakeup;
+
+    template <class Ready>
+    void wait(Ready ready) {
+        for (int spin = 0; spin < 64; ++spin) {
+            if (ready()) return;
+            this_thread::yield();
+        }
+        while (!ready()) {
+            unique_lock<mutex> guard(lock);
+            sleeping = true;
+            if (!ready()) wakeup.wait_for(guard, chrono::milliseconds(1));
+        }
     }
-
-    inline void storeChar(int c) { store += c; }
-    inline void clearStore() { store = ""; }
-    inline void flushStore() {
-        if (!store.empty()) printf("%s", store.c_str());
-        clearStore();
+    void notify() {
+        if (sleeping.exchange(false)) {
+            lock_guard<mutex> guard(lock);
+            wakeup.notify_all();
+        }
     }
 
-    void cleanAfterBracketParse(bool parseSuccess) {
-        parseSuccess ? clearStore() : flushStore();
-        parsedColorParts = 0;
-        state            = (parseSuccess && (bracketMask & TRIM)) ? SKIP_LEADING_PADDING_STATE : DEFAULT_STATE;
-        bracketMask      = EMPTY_FORMAT_MASK;
+   public:
+    explicit Ring(size_t capacity) : data(capacity), mask(capacity - 1) { assert((capacity & mask) == 0); }
+
+    // writes all bytes, waiting for space
+    void write(const char* src, size_t size) {
+        size_t h = head.load(memory_order_relaxed);
+        while (size > 0) {
+            wait([&] { return h - tail.load(memory_order_acquire) < data.size(); });
+            size_t n = min({size, data.size() - (h - tail.load(memory_order_acquire)), data.size() - (h & mask)});
+            memcpy(&data[h & mask], src, n);
+            head.store(h += n, memory_order_release);
+            src += n, size -= n;
+            notify();
+        }
     }
 
-#pragma endregion
-
-   public:
-    // strip: should formatting be parsed to ANSI or stripped off
-    FormatterAutomaton(bool strip, bool escape, bool sanitize) 
-        : strip(strip), escape(escape), sanitize(sanitize) {
-        formatStack.push(INITIAL_FORMAT_MASK);
-        printANSI(formatToAnsi(formatStack.top()));
+    // reads available bytes, waits for some if there are none; calls idle() before waiting.
+    // Returns 0 once the ring is closed and empty.
+    template <class Idle>
+    size_t read(char* dst, size_t size, Idle idle) {
+        size_t t = tail.load(memory_order_relaxed);
+        auto   available = [&] { return head.load(memory_order_acquire) - t; };
+        if (available() == 0 && !closed.load(memory_order_acquire)) {
+            idle();
+            wait([&] { return available() > 0 || closed.load(memory_order_acquire); });
+        }
+        size_t n = min({size, available(), data.size() - (t & mask)});
+        memcpy(dst, &data[t & mask], n);
+        tail.store(t + n, memory_order_release);
+        notify();
+        return n;
     }
 
-    ~FormatterAutomaton() {
-        flushStore();
-        if(sanitize)
-            printANSI(formatToAnsi(INITIAL_FORMAT_MASK));
+    void close() {
+        closed.store(true, memory_order_release);
+        sleeping = true;  // wake up consumer unconditionally
+        notify();
     }
+};
 
-    void accept(int c) {
-        static size_t found = string::npos;
-
-
-        // parsing escape
-        if (state == PARSE_ESCAPE_STATE) {
-            switch (c) {
-                case '\\': clearStore(); printf("\\"); break; // backslash
-                case 'a' : clearStore(); printf("\a"); break; // alert (bell)
-                case 'b' : clearStore(); printf("\b"); break; // backspace
-                case 'r' : clearStore(); printf("\r"); break; // carraiage return
-                case 'n' : clearStore(); printf("\n"); break; // newline (line feed)
-                case 'f' : clearStore(); printf("\f"); break; // form feed
-                case 't' : clearStore(); printf("\t"); break; // horizontal tab
-                case 'v' : clearStore(); printf("\v"); break; // vertical tab
-                default:                                      // invalid escape - print as is
-                    storeChar(c);
-                    flushStore();
-                    break;
-            }
-            state = DEFAULT_STATE;
-        } else if (escape == true && c == '\\') {
-            flushStore();
-            storeChar(c);  // store = "\"
-            state = PARSE_ESCAPE_STATE;
+// Runs f(istream) with input read from fd by a reader thread and output to outstream written to STDOUT
+// by a writer thread, so that formatting doesn't stop for blocking reads and writes. Output is flushed
+// whenever formatting waits for input, so interactive use stays responsive.
+template <class F>
+void pipelined(int fd, F&& f) {
+    Ring input(1 << 20), output(1 << 20);
+
+    thread reader([&] {
+        char    buffer[1 << 16];
+        ssize_t n;
+        while ((n = read(fd, buffer, sizeof(buffer))) != 0) {
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) break;
+            input.write(buffer, n);
         }
+        input.close();
+    });
+    fflush(stdout);
+    thread writer([&] {
+        char   buffer[1 << 16];
+        size_t n;
+        bool   ok = true;
+        while ((n = output.read(buffer, sizeof(buffer), [] {})) > 0)
+            ok = ok && writeAll(STDOUT_FILENO, buffer, n);  // drain on error, so that formatting can't block
+    });
+
+    FILE* previous = outstream;
+    outstream = fopencookie(&output, "w", {NULL, [](void* ring, const char* data, size_t size) -> ssize_t {
+                                             ((Ring*)ring)->write(data, size);
+                                             return size;
+                                         }, NULL, NULL});
+    FILE* istream = fopencookie(&input, "r", {[](void* ring, char* data, size_t size) -> ssize_t {
+                                                  return ((Ring*)ring)->read(data, size, [] { fflush(outstream); });
+                                              }, NULL, NULL, NULL});
+    setvbuf(outstream, NULL, _IOFBF, 1 << 16);
+    // streams are used only by the formatting thread, so stdio doesn't have to lock them
+    __fsetlocking(istream, FSETLOCKING_BYCALLER);
+    __fsetlocking(outstream, FSETLOCKING_BYCALLER);
+    if (teeFile) __fsetlocking(teeFile, FSETLOCKING_BYCALLER);
+
+    f(istream);
+
+    fclose(istream);
+    fclose(outstream);
+    outstream = previous;
+    output.close();
+    writer.join();
+    reader.join();  // input is read to the end
+}
 
+#ifdef __linux__
+// Feeds input from pipe `fd` to automaton writing to pipe on STDOUT, except for runs of plain characters
+// that the resting automaton would copy verbatim, which are moved with splice() without a copy to user
+// space. Input is peeked with tee() into another pipe to find the runs. When chunks have no long runs,
+// peeking backs off to plain reads. Returns false if input couldn't be peeked at all.
+template <class Automaton>
+bool formatSpliced(int fd, Automaton& automaton) {
+    const size_t SPLICE_MIN = 1 << 10;  // shorter runs don't pay off the syscalls
+
+    int peek[2];
+    if (pipe(peek) < 0) return false;
+    char   buffer[1 << 16], consumed[1 << 16];
+    size_t backoff = 0, reads = 0;  // plain reads before next peek
+    bool   ok      = true;
+
+    // calls transfer(size) until `size` bytes are transferred
+    auto exactly = [](size_t size, auto transfer) {
+        while (size > 0) {
+            ssize_t n = transfer(size);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            size -= n;
+        }
+        return true;
+    };
+    // removes from input `size` bytes that were already peeked
+    auto consume = [&](size_t size) { return exactly(size, [&](size_t left) { return read(fd, consumed, left); }); };
+    auto moveThrough = [&](size_t size) {
+        fflush(outstream);  // formatted output goes first
+        auto start = Clock::now();
+        bool moved = exactly(size, [&](size_t left) { return splice(fd, NULL, STDOUT_FILENO, NULL, left, SPLICE_F_MOVE); });
+        outputTime += Clock::now() - start;  // counted for --stats as the output of OutputSink is
+        if (moved) bytesOut += size;
+        return moved;
+    };
+
+    while (ok) {
+        ssize_t n;
+        if (reads > 0) {
+            --reads;
+            if ((n = read(fd, buffer, sizeof(buffer))) < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            automaton.feed(string_view(buffer, n));
+            continue;
+        }
 
-        // potential whitespace trimming - increases memory in TRIM mode
-        else if (isspace(c)) {
-            if (state != SKIP_LEADING_PADDING_STATE || strip)  // skip whitespace if trim mode
-                storeChar(c);
+        if ((n = tee(fd, peek[1], sizeof(buffer), 0)) < 0 && errno == EINTR) continue;
+        if (n < 0 && reads == 0 && backoff == 0) {  // not peekable, nothing was consumed yet
+            close(peek[0]), close(peek[1]);
+            return false;
+        }
+        if (n <= 0) break;
+        char* peeked = buffer;
+        if (!exactly(n, [&](size_t left) { ssize_t r = read(peek[0], peeked, left); peeked += max<ssize_t>(r, 0); return r; }))
+            break;
+
+        size_t done = 0, i = 0;  // bytes removed from input, bytes fed or moved
+        bool   moved = false;
+        while (i < (size_t)n && ok) {
+            if (!automaton.resting() || !delimiters.isPlain((unsigned char)buffer[i])) {
+                automaton.accept((unsigned char)buffer[i++]);
+                continue;
+            }
+            size_t end = i, visible = i;  // run of plain characters, up to its last visible one
+            while (end < (size_t)n && delimiters.isPlain((unsigned char)buffer[end]))
+                if (!isSpace((unsigned char)buffer[end++])) visible = end;
+            if (visible - i >= SPLICE_MIN) {
+                ok = consume(i - done) && moveThrough(visible - i);
+                automaton.skipped(string_view(buffer + i, visible - i));
+                done = i = visible, moved = true;
+            } else {
+                automaton.feed(string_view(buffer + i, end - i));
+                i = end;
+            }
+        }
+        ok = ok && consume(n - done);
 
-            if (!formatStack.top() & TRIM)  // if trimming mode is not currently enabled, we can safely print the whitespace
-                flushStore();
+        backoff = moved ? 0 : min<size_t>(max<size_t>(backoff * 2, 1), 64);
+        reads   = backoff;
+    }
+    close(peek[0]), close(peek[1]);
+    return true;
+}
+#else
+template <class Automaton>
+bool formatSpliced(int, Automaton&) { return false; }
+#endif
+
+// formats whole stream, in parallel or pipelined if requested
+void formatStream(FILE* istream, bool pipeline = f_pipeline) {
+    if (pipeline && f_jobs == 1 && fileno(istream) >= 0)
+        return pipelined(fileno(istream), [](FILE* input) { formatStream(input, false); });
+
+    // pipe to pipe moves parts that don't need formatting with splice()
+    struct stat in, out;
+    bool        splicing = f_jobs == 1 && !teeFile && !f_coalesce && outstream == stdout && fileno(istream) >= 0 &&
+                    fstat(fileno(istream), &in) == 0 && S_ISFIFO(in.st_mode) &&
+                    fstat(STDOUT_FILENO, &out) == 0 && S_ISFIFO(out.st_mode);
+
+    withCommandLine(0, [&](auto& out, auto strip, auto escape, auto sanitize) {
+        using Sink = std::decay_t<decltype(out)>;
+        // process input in parallel chunks as it is read
+        if (f_jobs > 1) {
+
+            using Formatter = ParallelFormatter<strip, escape, sanitize, Sink>;
+            Formatter formatter{(unsigned)f_jobs, out, delimiters, f_chunk ? f_chunk : Formatter::CHUNK_SIZE};
+            char      buffer[1 << 16];
+            size_t    n;
+            while ((n = fread(buffer, 1, sizeof(buffer), istream)) > 0)
+                formatter.feed(string_view(buffer, n));
+            stats += formatter.finish();
+        // read char by char
+        } else {
+
+            FormatterAutomaton<Sink, strip, escape, sanitize> automaton{out, delimiters};
+
+            if (!splicing || !formatSpliced(fileno(istream), automaton)) {
+                int c;
+                while ((c = getc(istream)) != EOF)
+                    automaton.accept(c);
+            }
+            automaton.finish();
+            stats += automaton.stats();
         }
+    });
+}
+
+// formats file mapped into memory, so that input isn't copied; other files are read as streams
+bool formatFile(const char* path) {
+    int         fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return false;
+    }
 
+    if (!S_ISREG(st.st_mode)) {  // pipes, process substitution etc.
+        FILE* istream = fdopen(fd, "r");
+        formatStream(istream);
+        fclose(istream);
+        return true;
+    }
 
-        // begin bracket parsing
-        else if (c == '{') {
-            flushStore();
-            storeChar(c);
-            bracketMask = EMPTY_FORMAT_MASK;
-            state       = PARSE_OPENING_BRACKET_STATE;
+    size_t size = st.st_size;
+    void*  data = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return false;
+    }
+    if (size > 0) madvise(data, size, MADV_SEQUENTIAL);
+
+    string_view input((const char*)data, size);
+    withCommandLine(1 << 16, [&](auto& out, auto strip, auto escape, auto sanitize) {
+        using Sink = std::decay_t<decltype(out)>;
+        if (f_jobs > 1) {
+            stats += formatParallel<strip, escape, sanitize>(input, f_jobs, out, delimiters, f_chunk);
+        } else {
+            FormatterAutomaton<Sink, strip, escape, sanitize> automaton{out, delimiters};
+            automaton.feed(input);
+            automaton.finish();
+            stats += automaton.stats();
         }
+    });
 
+    if (size > 0) munmap(data, size);
+    return true;
+}
 
-        // parsking end of opening bracket
-        else if (c == '-') {
-            storeChar(c);
-            if (state == PARSE_OPENING_BRACKET_STATE) {
-                static regex terminatorRegex("--$");
-                if (regex_search(store, terminatorRegex)) {  // success parsing bracket
-                    // deal with empty format {--
-                    printANSI(pushFormat(bracketMask));
-                    return cleanAfterBracketParse(true);
-                }
-            } else {
-                state = DEFAULT_STATE;  // to exit eventual trailing whitespace removal mode
+// formats NUL-terminated records of input separately, as arguments are formatted, with NUL-terminated output
+// records; the last record may be terminated by the end of input. One automaton formats all of them and output
+// is written once it grows to RECORDS_BUFFERING, i.e. in a single write for most batches.
+const size_t RECORDS_BUFFERING = 1 << 20;
+
+void formatRecords(FILE* istream) {
+    withCommandLine(RECORDS_BUFFERING, [&](auto& out, auto strip, auto escape, auto sanitize) {
+        using Sink = std::decay_t<decltype(out)>;
+        FormatterAutomaton<Sink, strip, escape, sanitize> automaton{out, delimiters};
+
+        char   buffer[1 << 16];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), istream)) > 0) {
+            for (size_t i = 0, end; i < n; i = end + 1) {
+                end = find(buffer + i, buffer + n, '\0') - buffer;
+                automaton.feed(string_view(buffer + i, end - i));
+                if (end == n) break;
+                automaton.next();  // format reset of the record goes before its terminator
+                automaton.sink()("", 1);
             }
         }
+        automaton.finish();  // prints nothing after the terminator of the last record
+        stats += automaton.stats();
+    });
+}
 
+// opens unix socket at path, either listening on it or connected to it
+int openSocket(const char* path, bool listening) {
+    sockaddr_un address = {};
+    address.sun_family  = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "%s: %s\n", path, strerror(ENAMETOOLONG));
+        return -1;
+    }
+    strcpy(address.sun_path, path);
 
-        // parsing options of opening bracket; '-' won't be caught anymore so it's good
-        else if (state == PARSE_OPENING_BRACKET_STATE && (found = formatChars.find(c)) != string::npos) {
-            storeChar(c);
+    struct stat st;
+    if (listening && stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);  // left by previous server
 
-            // dealing with color
-            if (found <= 18) {               // a ';' can be passed here
-                if (parsedColorParts < 2) {  // fg, bg not set
-                    bracketMask = WITH_COLOR(bracketMask, isupper(c) ? LIGHTER(found - 11) : found, parsedColorParts);
-                    ++parsedColorParts;
-                } else {  // too much color parts
-                    return cleanAfterBracketParse(false);
-                }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || (listening ? bind(fd, (sockaddr*)&address, sizeof(address)) < 0 || listen(fd, SOMAXCONN) < 0
+                             : connect(fd, (sockaddr*)&address, sizeof(address)) < 0)) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
 
-                // dealing with symbols
-            } else {
-                mask_t opMask;
-                switch (c) {  // todo check if valid
-                    case '%': opMask = REVERSED; break;
-                    case '!': opMask = BLINK; break;
-                    case '*': opMask = BOLD; break;
-                    case '/': opMask = ITALIC; break;
-                    case '_': opMask = UNDERLINE; break;
-                    case '^': opMask = OVERLINE; break;
-                    case '=': opMask = DOUBLE_UNDERLINE; break;
-                    case '~': opMask = STRIKETHROUGH; break;
-                    case '.': opMask = DIM; break;
-                    case '#': opMask = TRIM; break;
-                    case '0': opMask = RESET; break;
+// answers each NUL-terminated request of the client with NUL-terminated output, as if it was an argument
+void serveClient(int fd) {
+    withOptions(f_strip, f_escape, !f_no_sanitize, [&](auto strip, auto escape, auto sanitize) {
+        FormatterAutomaton<StringSink, strip, escape, sanitize> automaton{StringSink(), delimiters};
+        string& out = automaton.sink().out;
+
+        char    buffer[1 << 16];
+        bool    started = false, finished = false;  // state of current request
+        ssize_t n;
+        while ((n = read(fd, buffer, sizeof(buffer))) != 0) {
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) break;
+
+            for (ssize_t i = 0; i < n; ++i) {
+                if (finished) automaton.reset();  // lazily, so that nothing is sent after the last request
+                started = true, finished = false;
+                if (buffer[i] != '\0') {
+                    automaton.accept((unsigned char)buffer[i]);
+                    continue;
                 }
-                if (bracketMask & opMask)  // operator was already used
-                    return cleanAfterBracketParse(false);
-                else
-                    bracketMask |= opMask;
+                automaton.finish();
+                out.push_back('\0');
+                started = false, finished = true;
             }
+            // one write for all requests pipelined in the buffer, large requests are streamed
+            if (!writeAll(fd, out.data(), out.size())) break;
+            out.clear();
         }
+        if (started) {  // unterminated last request
+            automaton.finish();
+            out.push_back('\0');
+            writeAll(fd, out.data(), out.size());
+        }
+    });
+    close(fd);
+}
 
+int serve(const char* path) {
+    int server = openSocket(path, true);
+    if (server < 0) return EXIT_FAILURE;
+    signal(SIGPIPE, SIG_IGN);  // clients can leave before reading the output
 
-        // end the formatting. trippy: {--}
-        else if (c == '}') {
-            storeChar(c);
-            static regex closingBracket(R"(--}$)");
-            static regex closingPaddingBracket(R"(\s*--}$)");
-            if (regex_search(store, closingBracket)) {
-                if (formatStack.size() > 1)  // don't truncate unbalanced pairs
-                    store = regex_replace(store,
-                                          (formatStack.top() & TRIM) && !strip
-                                              ? closingPaddingBracket
-                                              : closingBracket,
-                                          "");
-
-                flushStore();
-
-                printANSI(popFormat());
-                state = DEFAULT_STATE;
+    while (true) {
+        int client = accept(server, NULL, NULL);
+        if (client >= 0) thread(serveClient, client).detach();
+        else if (errno != EINTR && errno != ECONNABORTED) break;
+    }
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    close(server);
+    return EXIT_FAILURE;
+}
 
-            } else {  // some giberrish } in text, continue
-                flushStore();
-                state = DEFAULT_STATE;
+// sends args (or stdin as one request) to the server and prints the output, args separated with spaces
+int connectTo(const char* path, int argc, char* argv[]) {
+    int fd = openSocket(path, false);
+    if (fd < 0) return EXIT_FAILURE;
+
+    // requests are written in parallel, so that the server can't block on output nobody reads yet
+    thread writer([&] {
+        if (argc > 0) {
+            for (int i = 0; i < argc; ++i)
+                if (!writeAll(fd, argv[i], strlen(argv[i]) + 1)) break;
+        } else {
+            char   buffer[1 << 16];
+            char   last = '\0';
+            size_t n, total = 0;
+            while ((n = read(STDIN_FILENO, buffer, sizeof(buffer))) > 0 && writeAll(fd, buffer, n))
+                last = buffer[n - 1], total += n;
+            if (total == 0 || last != '\0') writeAll(fd, "", 1);  // terminate the request
+        }
+        shutdown(fd, SHUT_WR);
+    });
+
+    const char* separator = argc > 0 ? " " : "";
+    bool        pending   = false;  // separator after the last complete output
+    char        buffer[1 << 16];
+    ssize_t     n;
+    while ((n = read(fd, buffer, sizeof(buffer))) != 0) {
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) break;
+        for (ssize_t i = 0, end; i < n; i = end + 1) {
+            end = find(buffer + i, buffer + n, '\0') - buffer;
+            if (pending && end > i) fputs(separator, stdout), pending = false;
+            fwrite(buffer + i, 1, end - i, stdout);
+            if (end < n) {
+                if (pending) fputs(separator, stdout);  // empty output
+                pending = true;
             }
         }
+    }
+    int status = n < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    writer.join();
+    close(fd);
+    return status;
+}
 
-
-        // any normal characters or breaking current context
-        else {
-            storeChar(c);
-            flushStore();
-            state = DEFAULT_STATE;
+// parses "OPEN SEPARATOR CLOSE" of -T into delimiters
+bool parseTags(const char* tags) {
+    static string parts[3];  // delimiters only view them
+    size_t        count = 0;
+    for (const char* c = tags; *c;) {
+        if (isSpace((unsigned char)*c)) {
+            ++c;
+            continue;
         }
+        const char* end = c;
+        while (*end && !isSpace((unsigned char)*end)) ++end;
+        if (count == 3) return false;
+        parts[count++].assign(c, end);
+        c = end;
     }
-};
-
-// pushing new formatting on stack introduces ANSI entry sequence
-// popping formatting from stack:
-//   1. outputs RESET sequence
-//   2. introduces stack's top ANSI entry sequence
-// thanks to that we can always reset on exit sequences
-
-static int f_strip;
-static int f_escape;
-static int f_no_sanitize;
-
-static struct option longOptions[] = {
-    {"help",        no_argument, NULL,              'h'},
-    {"version",     no_argument, NULL,              'v'},
-    {"legend",      no_argument, NULL,              'l'},
-    {"strip",       no_argument, &f_strip,          's'},
-    {"escape",      no_argument, &f_escape,         'e'},
-    {"no-sanitize", no_argument, &f_no_sanitize,    'S'},
-    {"demo"       , no_argument, NULL,               0 },
-    {NULL,          0,           NULL,               0 },
-};
+    if (count != 3 || !Delimiters::valid(parts[0], parts[1], parts[2])) return false;
+    delimiters = Delimiters(parts[0], parts[1], parts[2]);
+    return true;
+}
 
 int main(int argc, char* argv[]) {
 
@@ -523,14 +797,26 @@ int main(int argc, char* argv[]) {
     int optIdx; // index in long_options of parsed option
     
     FILE* istream = stdin;
+    const char* serveSocket   = NULL;
+    const char* connectSocket = NULL;
     // parse all options
     // https://azrael.digipen.edu/~mmead/www/Courses/CS180/getopt.html
-    while ((opt = getopt_long(argc, argv, "?hvlseS", longOptions, &optIdx)) != -1) {
+    while ((opt = getopt_long(argc, argv, "?hvlseSfpb0cj:t:T:", longOptions, &optIdx)) != -1) {
         switch (opt) {
             case 0:
+                if (longOptions[optIdx].flag) break;  // flag was set by getopt
                 if (strcmp(longOptions[optIdx].name, "demo") == 0) {
                     istream = fmemopen((void*)DEMO, strlen(DEMO), "r");   
                     break;
+                } else if (strcmp(longOptions[optIdx].name, "serve") == 0) {
+                    serveSocket = optarg;
+                    break;
+                } else if (strcmp(longOptions[optIdx].name, "connect") == 0) {
+                    connectSocket = optarg;
+                    break;
+                } else if (strcmp(longOptions[optIdx].name, "chunk") == 0) {
+                    f_chunk = strtoull(optarg, NULL, 10);
+                    break;
                 } else goto unrecognizedLong;
             case 'h': 
                 printf(USAGE+1, argv[0]);
@@ -541,6 +827,30 @@ int main(int argc, char* argv[]) {
             case 'e': f_escape = 1; break;
             case 's': f_strip = 1; break;
             case 'S': f_no_sanitize = 1; break;
+            case 'f': f_file = 1; break;
+            case 'p': f_pipeline = 1; break;
+            case 'b': f_batch = 1; break;
+            case '0': f_null = 1; break;
+            case 'c': f_coalesce = 1; break;
+            case 'j':
+                f_jobs = atoi(optarg);
+                if (f_jobs <= 0) f_jobs = max(1u, thread::hardware_concurrency());
+                break;
+            case 'T':
+                if (!parseTags(optarg)) {
+                    fprintf(stderr, "%s: invalid tags, expected 3 delimiters without whitespace, up to %zu "
+                                    "characters and no format characters in the second one\n",
+                            optarg, Delimiters::MAX_LENGTH);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 't':
+                if (teeFile) fclose(teeFile);
+                if (!(teeFile = fopen(optarg, "w"))) {
+                    fprintf(stderr, "%s: %s\n", optarg, strerror(errno));
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case '?': 
                 unrecognizedLong:
                 fprintf(stderr, USAGE + 1, argv[0]);
@@ -549,29 +859,58 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    int  status = EXIT_SUCCESS;
+    auto start  = Clock::now();
+
+    if (serveSocket) exit(serve(serveSocket));
+    if (connectSocket) exit(connectTo(connectSocket, argc - optind, argv + optind));
+
+    // read files from positional arguments
+    if (f_file) {
+        for (; optind < argc; ++optind)
+            if (!formatFile(argv[optind])) status = EXIT_FAILURE;
     // read from positional arguments
-    if(optind < argc) {
-        while (optind < argc) {
-            static string separator = "";  // to print arguments separated with spaces
-            printf("%s", separator.c_str());
-
-            // parse the argument
-            FormatterAutomaton automaton = FormatterAutomaton(f_strip, f_escape, !f_no_sanitize);
-            for (char* it = argv[optind]; *it; ++it)  // read null terminated c_string
-                automaton.accept(*it);
-
-            separator = " ";
-            optind++;
-        }
-    // read from STDIN
-    } else {
+    } else if(optind < argc) {
+        if (f_batch) setvbuf(outstream, NULL, _IONBF, 0);  // whole output is written from the sink at once
+        withCommandLine(f_batch ? SIZE_MAX : 0, [&](auto& out, auto strip, auto escape, auto sanitize) {
+            using Sink = std::decay_t<decltype(out)>;
+            if (f_batch) {
+                FormatterAutomaton<Sink, strip, escape, sanitize> automaton{out, delimiters};
+                for (; optind < argc; ++optind) {
+                    automaton.next();  // every argument is an input of the batch, reset only if left formatted
+                    automaton.feed(argv[optind]);
+                    if (optind + 1 < argc) {  // the space is still in the format of the argument, as without -b
+                        automaton.finish();
+                        automaton.sink()(" ", 1);
+                    }
+                }
+                automaton.finish();
+                stats += automaton.stats();
+                return;
+            }
+            for (; optind < argc; ++optind) {
+                static string separator = "";  // to print arguments separated with spaces
+                out(separator.data(), separator.size());
 
-        FormatterAutomaton automaton = FormatterAutomaton(f_strip, f_escape, !f_no_sanitize);
+                // parse the argument
+                FormatterAutomaton<Sink, strip, escape, sanitize> automaton{out, delimiters};
+                automaton.feed(argv[optind]);
+                automaton.finish();
+                stats += automaton.stats();
 
-        int c;
-        while ((c = getc(istream)) != EOF)
-            automaton.accept(c);
+                separator = " ";
+            }
+        });
+    // read records from STDIN
+    } else if (f_null) {
+        setvbuf(outstream, NULL, _IONBF, 0);  // output is buffered by the sink
+        formatRecords(istream);
+    // read from STDIN
+    } else {
+        formatStream(istream);
     }
 
-    exit(EXIT_SUCCESS);
+    if (teeFile && fclose(teeFile) != 0) status = EXIT_FAILURE;
+    if (f_stats) fflush(stdout), printStats(Clock::now() - start);
+    exit(status);
 }
@@ -0,0 +1,1426 @@
+#pragma once
+
+// Header-only library of the markdown-like formatter, translating '{<format>--' and '--}' tags to ANSI.
+// Requires C++17. Output is written to a sink -- any callable taking (const char* data, size_t size):
+//
+//     formatter::FormatterAutomaton automaton(formatter::FileSink(stdout));
+//     automaton.feed("{R*--ERROR--} disk is full");
+//
+// Sinks provided: FileSink (optionally buffered), BufferSink (preallocated memory), IteratorSink (output
+// iterator), StringSink, TeeSink (colored and stripped output at once) and CoalescingSink (merging SGR
+// sequences of output, e.g. with ANSI already in the input). Reusing one automaton with format() doesn't
+// allocate once store and stack have grown to the sizes required by the input; next() separates inputs
+// of a batch written to the same output without the format resets between them.
+//
+// With C++20 constant literals can be formatted at compile time: "{R*--ERROR--} disk is full"_fmt.
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// automaton can run at compile time since C++20, which gives the _fmt literal
+#if __cplusplus >= 202002L
+#define FORMATTER_CONSTEXPR constexpr
+#else
+#define FORMATTER_CONSTEXPR
+#endif
+
+namespace formatter {
+
+/*
+format bitmask:     ┃ valid|0|# ┃ .|~|=|^|_|/|*|!|% ┃          ┃ light bg|bg ┃ light fg|fg ┃
+bit widths:     MSB ┃   1  |1|1 ┃ 1|1|1|1|1|1|1|1|1 ┃          ┃    1    | 4 ┃    1    | 4 ┃ LSB
+                    ┃  ctrl(3b) ┃    fmt(9b)        ┃ pad(10b) ┃     bg(5b)  ┃     fg(5b)  ┃
+*/
+
+typedef std::uint32_t mask_t;
+
+enum Masks : mask_t {
+    //-COLOR-MASKS----------
+    FG_LIGHT = 0x10 << 0,            // mask light bit of fg
+    FG_COLOR = 0x0f << 0,            // mask for color code of fg
+    FG_MASK  = FG_LIGHT | FG_COLOR,  // mask for whole FG of
+    BG_LIGHT = FG_LIGHT << 5,
+    BG_COLOR = FG_COLOR << 5,
+    BG_MASK  = BG_LIGHT | BG_COLOR,  // mask for all BG
+
+    BLACK   = 0,  // ANSI color base +0
+    RED     = 1,
+    GREEN   = 2,
+    YELLOW  = 3,
+    BLUE    = 4,
+    MAGENTA = 5,
+    CYAN    = 6,
+    WHITE   = 7,
+
+    //-COLOR-SPECIAL--------
+    DEFAULT_COLOR = 9,   // 0b1001  default terminal color: ANSI color base +9
+    CURRENT_COLOR = 10,  // 0b1010  means that last used color should be used.
+
+    //-FORMAT---------------
+    FORMAT_MASK = 0x1ffu << 20,
+
+    REVERSED         = 1u << 20,
+    BLINK            = 1u << 21,
+    BOLD             = 1u << 22,
+    ITALIC           = 1u << 23,
+    UNDERLINE        = 1u << 24,
+    OVERLINE         = 1u << 25,
+    DOUBLE_UNDERLINE = 1u << 26,
+    STRIKETHROUGH    = 1u << 27,
+    DIM              = 1u << 28,
+
+    //-CONTROL--------------
+    TRIM  = 1u << 29,
+    RESET = 1u << 30,
+    VALID = 1u << 31,
+
+    //-SPECIAL-MASKS--------
+    INITIAL_FORMAT_MASK = VALID | RESET | DEFAULT_COLOR << 5 | DEFAULT_COLOR,
+    EMPTY_FORMAT_MASK   = VALID | CURRENT_COLOR << 5 | CURRENT_COLOR,
+};
+
+constexpr std::string_view formatChars =
+    "krgybmcw"      // 0-7
+    "-"             // 8
+    "d;"            // 9-10
+    "KRGYBMCW"      // 11-18
+    "%!*/_^=~.#0";  // 19-29
+
+// isspace(), isupper() and isdigit() of the "C" locale, usable at compile time
+constexpr bool isSpace(int c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+constexpr bool isUpper(int c) { return c >= 'A' && c <= 'Z'; }
+constexpr bool isDigit(int c) { return c >= '0' && c <= '9'; }
+
+constexpr mask_t GET_FG(mask_t mask) { return (mask & FG_COLOR) >> 0; }                              // returns FG on LSBits
+constexpr mask_t GET_BG(mask_t mask) { return (mask & BG_COLOR) >> 5; }                              // returns BG on LSBits
+constexpr mask_t LIGHTER(mask_t color) { return color | (1 << 4); }                                  // returns lighter color mask
+constexpr int MASK_TO_FG_ANSI(mask_t mask) { return GET_FG(mask) + 30 + (mask & FG_LIGHT ? 60 : 0); }  // returns ANSI code for fg color
+constexpr int MASK_TO_BG_ANSI(mask_t mask) { return GET_BG(mask) + 40 + (mask & BG_LIGHT ? 60 : 0); }  // returns ANSI code for bg color
+// returns mask with submask from other
+constexpr mask_t OVERRIDE(mask_t target, mask_t submask, mask_t source) { return (target & ~submask) | (source & submask); }
+// returns mask with set primary(part=0) or secondary(part!=0) color
+constexpr mask_t WITH_COLOR(mask_t mask, mask_t color, int part) {
+    return OVERRIDE(mask, (part == 0 ? FG_MASK : BG_MASK), color | color << 5);
+}
+
+// longest ANSI sequence built by formatToAnsi(): "\e[0;1;2;3;4;6;7;9;21;53;97;107m"
+constexpr size_t ANSI_MAX_LENGTH = 32;
+
+// converts absolute format mask to ANSI sequence written to `ANSI`, returns its length
+FORMATTER_CONSTEXPR size_t formatToAnsi(mask_t format, char (&ANSI)[ANSI_MAX_LENGTH]) {
+    assert(format & VALID && format & RESET);
+
+    int    codes[12];
+    size_t count = 0;
+    // ANSI VALUES
+    if (format & RESET) codes[count++] = 0;
+    if (format & BOLD) codes[count++] = 1;
+    if (format & DIM) codes[count++] = 2;
+    if (format & ITALIC) codes[count++] = 3;
+    if (format & UNDERLINE) codes[count++] = 4;
+    if (format & BLINK) codes[count++] = 6;
+    if (format & REVERSED) codes[count++] = 7;
+    if (format & STRIKETHROUGH) codes[count++] = 9;
+    if (format & DOUBLE_UNDERLINE) codes[count++] = 21;
+    if (format & OVERLINE) codes[count++] = 53;
+    codes[count++] = MASK_TO_FG_ANSI(format);
+    codes[count++] = MASK_TO_BG_ANSI(format);
+
+    size_t length = 0;
+    ANSI[length++] = '\033';
+    ANSI[length++] = '[';
+    for (size_t i = 0; i < count; ++i) {
+        if (i > 0) ANSI[length++] = ';';
+        if (codes[i] >= 100) ANSI[length++] = '0' + codes[i] / 100;
+        if (codes[i] >= 10) ANSI[length++] = '0' + codes[i] / 10 % 10;
+        ANSI[length++] = '0' + codes[i] % 10;
+    }
+    ANSI[length++] = 'm';
+    return length;
+}
+
+// Tag delimiters: '<open><format><separator>' opens a format and '<close>' closes it, "{", "--" and "--}"
+// by default. They are compiled into a DFA recognizing all three (Aho-Corasick automaton with complete
+// transitions), which the automaton steps with every stored character, so matching costs O(1) per byte.
+class Delimiters {
+   public:
+    static constexpr size_t MAX_LENGTH = 16;
+    enum : uint8_t { OPEN = 1, SEPARATOR = 2, CLOSE = 4 };  // delimiters matched in a state
+
+    std::string_view open, separator, close;
+
+    // delimiters must be non-empty, up to MAX_LENGTH long and without whitespace; separator must not
+    // contain format characters
+    static constexpr bool valid(std::string_view open, std::string_view separator, std::string_view close) {
+        for (std::string_view delimiter : {open, separator, close}) {
+            if (delimiter.empty() || delimiter.size() > MAX_LENGTH) return false;
+            for (char c : delimiter)
+                if (isSpace((unsigned char)c)) return false;
+        }
+        for (char c : separator)
+            if (formatChars.find(c) != std::string_view::npos && c != '-') return false;
+        return true;
+    }
+
+    constexpr Delimiters(std::string_view open, std::string_view separator, std::string_view close)
+        : open(open), separator(separator), close(close) {
+        assert(valid(open, separator, close));
+
+        // trie of delimiters, NONE for missing edges
+        constexpr uint8_t NONE = 0xFF;
+        uint8_t           trie[STATES][256]{};
+        for (auto& edges : trie)
+            for (uint8_t& edge : edges) edge = NONE;
+        uint8_t states = 1;
+        uint8_t flag   = OPEN;
+        for (std::string_view delimiter : {open, separator, close}) {
+            uint8_t state = 0;
+            for (char c : delimiter) {
+                uint8_t& edge = trie[state][(unsigned char)c];
+                if (edge == NONE) edge = states++;
+                state = edge;
+                bytes[(unsigned char)c] |= flag;
+            }
+            matched[state] |= flag;
+            flag <<= 1;
+        }
+
+        // complete transitions through failure links in BFS order
+        uint8_t queue[STATES]{}, fail[STATES]{};
+        size_t  head = 0, tail = 0;
+        queue[tail++] = 0;
+        while (head < tail) {
+            uint8_t state = queue[head++];
+            for (int c = 0; c < 256; ++c) {
+                uint8_t child = trie[state][c];
+                if (child == NONE) {
+                    next[state][c] = state == 0 ? 0 : next[fail[state]][c];
+                    continue;
+                }
+                fail[child] = state == 0 ? 0 : next[fail[state]][c];
+                matched[child] |= matched[fail[child]];
+                next[state][c] = child;
+                queue[tail++]  = child;
+            }
+        }
+    }
+
+    // state after `c`, 0 when no delimiter can be in progress
+    constexpr uint8_t step(uint8_t state, unsigned char c) const { return next[state][c]; }
+    // delimiters ending in the state
+    constexpr uint8_t matches(uint8_t state) const { return matched[state]; }
+
+    constexpr bool inSeparator(unsigned char c) const { return bytes[c] & SEPARATOR; }
+    // whether `c` can't start or end a tag or an escape, so that runs of such characters pass through
+    // resting automaton unchanged, apart from buffering whitespace
+    constexpr bool isPlain(unsigned char c) const { return !bytes[c] && c != '\\'; }
+    // whether the state after accepting `c` at line start is the same no matter the previous state,
+    // apart from the format stack and parsedColorParts. Such lines are safe to process independently.
+    constexpr bool isResync(unsigned char c) const {
+        return isPlain(c) && !isSpace(c) && formatChars.find(c) == std::string_view::npos;
+    }
+
+   private:
+    static constexpr size_t STATES = 3 * MAX_LENGTH + 1;
+
+    uint8_t next[STATES][256]{};
+    uint8_t matched[STATES]{};
+    uint8_t bytes[256]{};  // delimiters containing the byte
+};
+
+inline constexpr Delimiters DEFAULT_DELIMITERS{"{", "--", "--}"};
+
+// writes to FILE; with `buffering` > 0 output is collected in blocks of that size first
+class FileSink {
+    FILE*       file;
+    size_t      buffering;
+    std::string buffer;
+
+   public:
+    explicit FileSink(FILE* file, size_t buffering = 0) : file(file), buffering(buffering) {}
+    FileSink(const FileSink& other) : file(other.file), buffering(other.buffering) {}
+    ~FileSink() { flush(); }
+
+    void operator()(const char* data, size_t size) {
+        if (buffering == 0) {
+            fwrite(data, 1, size, file);
+            return;
+        }
+        buffer.append(data, size);
+        if (buffer.size() >= buffering) flush();
+    }
+
+    void flush() {
+        if (!buffer.empty()) fwrite(buffer.data(), 1, buffer.size(), file);
+        buffer.clear();
+    }
+};
+
+// writes to preallocated memory; output that doesn't fit is dropped and marked with `overflow`
+struct BufferSink {
+    char*  data;
+    size_t capacity;
+    size_t size     = 0;
+    bool   overflow = false;
+
+    BufferSink(char* data, size_t capacity) : data(data), capacity(capacity) {}
+
+    void operator()(const char* chunk, size_t length) {
+        if (length > capacity - size) {
+            length   = capacity - size;
+            overflow = true;
+        }
+        memcpy(data + size, chunk, length);
+        size += length;
+    }
+};
+
+// writes through output iterator, e.g. std::back_inserter
+template <class OutputIt>
+struct IteratorSink {
+    OutputIt it;
+
+    explicit IteratorSink(OutputIt it) : it(it) {}
+
+    void operator()(const char* data, size_t size) { it = std::copy(data, data + size, it); }
+};
+
+// appends to owned string
+struct StringSink {
+    std::string out;
+
+    void operator()(const char* data, size_t size) { out.append(data, size); }
+};
+
+// Sends output with ANSI to `colored` and stripped output to `plain` from a single pass, i.e. `plain`
+// gets what the automaton would output with the strip option. Use with strip disabled.
+template <class Colored, class Plain>
+struct TeeSink {
+    Colored colored;
+    Plain   plain;
+
+    FORMATTER_CONSTEXPR void operator()(const char* data, size_t size) {
+        colored(data, size);
+        plain(data, size);
+    }
+    FORMATTER_CONSTEXPR void ansi(const char* data, size_t size) { colored(data, size); }
+    FORMATTER_CONSTEXPR void trimmed(const char* data, size_t size) { plain(data, size); }
+};
+
+// Sink can take ANSI sequences separately with ansi(data, size), and the whitespace removed by TRIM
+// (which is kept by the strip option) with trimmed(data, size). Other sinks get ANSI as the rest of
+// the output and never see the trimmed whitespace.
+template <class Sink, class = void>
+struct hasAnsi : std::false_type {};
+template <class Sink>
+struct hasAnsi<Sink, std::void_t<decltype(std::declval<Sink&>().ansi("", 0))>> : std::true_type {};
+
+template <class Sink, class = void>
+struct hasTrimmed : std::false_type {};
+template <class Sink>
+struct hasTrimmed<Sink, std::void_t<decltype(std::declval<Sink&>().trimmed("", 0))>> : std::true_type {};
+
+template <class Sink>
+FORMATTER_CONSTEXPR void writeAnsi(Sink& sink, const char* data, size_t size) {
+    if constexpr (hasAnsi<Sink>::value) sink.ansi(data, size);
+    else sink(data, size);
+}
+
+template <class Sink>
+FORMATTER_CONSTEXPR void writeTrimmed(Sink& sink, const char* data, size_t size) {
+    if constexpr (hasTrimmed<Sink>::value) sink.trimmed(data, size);
+}
+
+// Collapses consecutive SGR sequences ("\e[...m") of a byte stream into a single minimal one, emitted right
+// before the next byte that isn't SGR, e.g. the formatter's "\e[0;39;49m" followed by "\e[1m\e[31m" from the
+// input becomes "\e[0;1;31m". Terminal state is tracked per attribute, so sequences that don't change it
+// disappear and a change is written as the shorter of the difference and a reset with the whole state.
+// Other control sequences and SGR parameters it doesn't track (e.g. fonts) are passed through as they are.
+class SgrCoalescer {
+   public:
+    static constexpr size_t SEQUENCE_MAX = 64;  // longer control sequences are passed through unparsed
+
+    template <class Sink>
+    void write(Sink& sink, const char* data, size_t size) {
+        for (size_t i = 0; i < size;) {
+            if (state == TEXT) {
+                const char* escape = (const char*)memchr(data + i, '\033', size - i);
+                size_t      end    = escape ? escape - data : size;
+                if (end > i) {
+                    sync(sink);
+                    sink(data + i, end - i);
+                }
+                if (end < size) sequence[length++] = '\033', state = ESCAPE, ++end;
+                i = end;
+                continue;
+            }
+            char c = data[i];
+            if (state == ESCAPE ? c != '[' : (c < 0x20 || c > 0x7e || length == SEQUENCE_MAX)) {
+                passSequence(sink, length == SEQUENCE_MAX);  // not a control sequence, c is text again
+                verbatim = true;
+                continue;
+            }
+            sequence[length++] = c;
+            ++i;
+            if (state == ESCAPE) state = CONTROL;
+            else if (c >= 0x40) endSequence(sink);  // final byte
+        }
+    }
+
+    // emits pending SGR and unfinished sequence, at the end of stream
+    template <class Sink>
+    void flush(Sink& sink) {
+        if (state != TEXT) passSequence(sink, false);
+        sync(sink);
+    }
+
+   private:
+    // tracked attributes with SGR codes setting and clearing them, the bit in State is their index
+    struct Attribute {
+        uint8_t on, off;
+    };
+    static constexpr Attribute ATTRIBUTES[] = {{1, 22}, {2, 22}, {3, 23}, {4, 24},  {5, 25}, {6, 25},
+                                               {7, 27}, {8, 28}, {9, 29}, {21, 24}, {53, 55}};
+    static constexpr size_t    COLORS       = sizeof(ATTRIBUTES) / sizeof(Attribute);  // bit of first color
+    static constexpr uint16_t  ALL          = (1 << (COLORS + 3)) - 1;
+    static constexpr uint16_t  UNDERLINES   = 1 << 3 | 1 << 9;
+
+    // color as the parameters setting it, e.g. "31" or "38;5;208"; empty for default
+    struct Color {
+        char    code[24];
+        uint8_t length = 0;
+
+        bool operator==(const Color& other) const {
+            return length == other.length && memcmp(code, other.code, length) == 0;
+        }
+    };
+
+    struct State {
+        uint16_t on    = 0;      // attributes set
+        uint16_t known = 0;      // attributes and colors with known value, the rest is as terminal had it
+        bool     clean = false;  // reset since attributes that aren't tracked could have been set
+        Color    colors[3];      // foreground, background, underline
+    };
+
+    enum { TEXT, ESCAPE, CONTROL } state = TEXT;
+    char   sequence[SEQUENCE_MAX];  // escape sequence being read
+    size_t length  = 0;
+    State  shown;                   // state terminal is left in by emitted output
+    State  wanted;                  // state requested by the stream so far
+    bool   pending  = false;        // wanted may differ from shown
+    bool   verbatim = false;        // after unfinished sequence, which would swallow the next one if it's dropped
+
+    // applies parameters of SGR sequence to state, returns false if some of them aren't tracked
+    static bool apply(State& state, std::string_view parameters) {
+        bool   tracked = true;
+        size_t count   = 0;
+        auto   untrack = [&] {  // parameters too complex to follow, nothing is known anymore
+            state.known = 0, state.clean = false;
+            return false;
+        };
+        std::string_view groups[32];
+        for (size_t start = 0;;) {
+            if (count == 32) return untrack();
+            size_t end      = std::min(parameters.find(';', start), parameters.size());
+            groups[count++] = parameters.substr(start, end - start);
+            if ((start = end + 1) > parameters.size()) break;
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            std::string_view group = groups[i];
+            size_t           colon = group.find(':');
+            int              code  = 0;
+            for (size_t j = 0; j < std::min(colon, group.size()) && code < 1000; ++j)
+                code = isDigit((unsigned char)group[j]) ? code * 10 + group[j] - '0' : 1000;
+
+            int color = code == 38 || (code >= 30 && code <= 37) || (code >= 90 && code <= 97) ? 0
+                        : code == 48 || (code >= 40 && code <= 47) || (code >= 100 && code <= 107) ? 1
+                        : code == 58 ? 2 : code == 39 ? 0 : code == 49 ? 1 : code == 59 ? 2 : -1;
+            if (color >= 0) {
+                std::string_view value = group;  // extended colors take following parameters, unless with colons
+                if ((code == 38 || code == 48 || code == 58) && colon == std::string_view::npos) {
+                    size_t more = i + 1 < count && groups[i + 1] == "5" ? 2 : i + 1 < count && groups[i + 1] == "2" ? 4 : 0;
+                    if (more == 0 || i + more >= count) return untrack();
+                    i += more;
+                    value = std::string_view(group.data(), groups[i].data() + groups[i].size() - group.data());
+                }
+                Color& target = state.colors[color];
+                if (code == 39 || code == 49 || code == 59) target.length = 0;
+                else if (value.size() <= sizeof(target.code)) memcpy(target.code, value.data(), target.length = value.size());
+                else {
+                    state.known &= ~(1 << (COLORS + color));
+                    tracked = false;
+                    continue;
+                }
+                state.known |= 1 << (COLORS + color);
+            } else if (colon != std::string_view::npos) {
+                if (code == 4) state.known &= ~UNDERLINES;  // underline styles aren't tracked
+                tracked = false;
+            } else if (code == 0) {
+                state = State();
+                state.known = ALL, state.clean = true;
+            } else {
+                bool found = false;
+                for (size_t bit = 0; bit < COLORS; ++bit) {
+                    if (ATTRIBUTES[bit].on == code) state.on |= 1 << bit, state.known |= 1 << bit, found = true;
+                    if (ATTRIBUTES[bit].off == code) state.on &= ~(1 << bit), state.known |= 1 << bit, found = true;
+                }
+                if (!found) tracked = false;
+            }
+        }
+        if (!tracked) state.clean = false;
+        return tracked;
+    }
+
+    // appends SGR code to `out`, separated with ';'
+    static void append(std::string_view code, char* out, size_t& size) {
+        if (size > 2) out[size++] = ';';
+        memcpy(out + size, code.data(), code.size());
+        size += code.size();
+    }
+    static void append(int code, char* out, size_t& size) {
+        char digits[4];
+        int  length = 0;
+        for (int rest = code; length == 0 || rest > 0; rest /= 10) digits[3 - length++] = '0' + rest % 10;
+        append(std::string_view(digits + 4 - length, length), out, size);
+    }
+    static void appendColor(const State& state, int color, char* out, size_t& size) {
+        const Color& c = state.colors[color];
+        c.length > 0 ? append(std::string_view(c.code, c.length), out, size) : append(39 + 10 * color, out, size);
+    }
+
+    // emits the shorter of SGR with changed attributes and a reset with the whole wanted state
+    template <class Sink>
+    void sync(Sink& sink) {
+        if (!pending) return;
+        pending = false;
+
+        char   changes[256] = "\033[", whole[256] = "\033[";
+        size_t changesSize = 2, wholeSize = 2;
+
+        uint16_t changed = wanted.known & (~shown.known | (shown.on ^ wanted.on)), cleared = 0;
+        for (size_t bit = 0; bit < COLORS; ++bit) {
+            if (!(changed & ~wanted.on & 1 << bit) || cleared & 1 << bit) continue;
+            append(ATTRIBUTES[bit].off, changes, changesSize);
+            for (size_t other = 0; other < COLORS; ++other)  // the off code clears the whole group
+                if (ATTRIBUTES[other].off == ATTRIBUTES[bit].off) cleared |= 1 << other;
+        }
+        for (size_t bit = 0; bit < COLORS; ++bit)
+            if (wanted.on & (changed | cleared) & 1 << bit) append(ATTRIBUTES[bit].on, changes, changesSize);
+        for (int color = 0; color < 3; ++color) {
+            uint16_t bit = 1 << (COLORS + color);
+            if (wanted.known & bit && (!(shown.known & bit) || !(shown.colors[color] == wanted.colors[color])))
+                appendColor(wanted, color, changes, changesSize);
+        }
+
+        if (wanted.clean) {  // reset is possible, and necessary if terminal could have untracked attributes
+            append(0, whole, wholeSize);
+            for (size_t bit = 0; bit < COLORS; ++bit)
+                if (wanted.on & 1 << bit) append(ATTRIBUTES[bit].on, whole, wholeSize);
+            for (int color = 0; color < 3; ++color)
+                if (wanted.colors[color].length > 0) appendColor(wanted, color, whole, wholeSize);
+        }
+        if (wanted.clean && (!shown.clean || wholeSize <= changesSize)) {
+            whole[wholeSize++] = 'm';
+            sink(whole, wholeSize);
+        } else if (changesSize > 2) {
+            changes[changesSize++] = 'm';
+            sink(changes, changesSize);
+        }
+        shown = wanted;
+    }
+
+    // writes buffered part of escape sequence as it is, after pending SGR
+    template <class Sink>
+    void passSequence(Sink& sink, bool overflow) {
+        sync(sink);
+        sink(sequence, length);
+        if (overflow) shown = wanted = State();  // the rest could still change anything
+        length = 0;
+        state  = TEXT;
+    }
+
+    template <class Sink>
+    void endSequence(Sink& sink) {
+        std::string_view parameters(sequence + 2, length - 3);
+        bool             sgr = sequence[length - 1] == 'm';
+        for (char c : parameters) sgr &= isDigit((unsigned char)c) || c == ';' || c == ':';
+
+        State next = wanted;
+        bool  kept = verbatim;
+        verbatim   = false;
+        if (sgr && apply(next, parameters) && !kept) {  // coalesced with the following SGR sequences
+            wanted  = next;
+            pending = true;
+            length  = 0;
+            state   = TEXT;
+            return;
+        }
+        passSequence(sink, false);
+        if (sgr) shown = wanted = next;
+    }
+};
+
+// Passes output through SgrCoalescer, e.g. when the input already has ANSI sequences. Pending SGR is written
+// by flush() or on destruction.
+template <class Sink>
+struct CoalescingSink {
+    Sink         sink;
+    SgrCoalescer coalescer;
+
+    explicit CoalescingSink(Sink sink) : sink(sink) {}
+    ~CoalescingSink() { flush(); }
+
+    void operator()(const char* data, size_t size) { coalescer.write(sink, data, size); }
+    void flush() { coalescer.flush(sink); }
+};
+
+// counters of the automaton's work, complete after finish()
+struct Stats {
+    size_t bytesIn      = 0;  // accepted characters
+    size_t openingTags  = 0;  // parsed '{<format>--'
+    size_t closingTags  = 0;  // parsed '--}', including unbalanced ones
+    size_t rejectedTags = 0;  // '{' not followed by a valid format and '--'
+    size_t ansi         = 0;  // ANSI sequences printed
+    size_t escapes      = 0;  // escape sequences translated
+    size_t maxDepth     = 0;  // the most formats on stack, not counting the initial one
+    size_t maxStore      = 0;  // the most characters buffered in store
+    size_t maxStoreBytes = 0;  // the most memory of store, less than maxStore with long runs packed
+
+    FORMATTER_CONSTEXPR Stats& operator+=(const Stats& other) {
+        bytesIn += other.bytesIn;
+        openingTags += other.openingTags;
+        closingTags += other.closingTags;
+        rejectedTags += other.rejectedTags;
+        ansi += other.ansi;
+        escapes += other.escapes;
+        maxDepth = std::max(maxDepth, other.maxDepth);
+        maxStore = std::max(maxStore, other.maxStore);
+        maxStoreBytes = std::max(maxStoreBytes, other.maxStoreBytes);
+        return *this;
+    }
+};
+
+// Format relative to the stack that the automaton was entered with. It resolves to
+// ((base & keep) ^ flip) | set, where base is the ref-th format from the top of that stack.
+// Format with keep == 0 doesn't depend on the entry stack, i.e. it's absolute.
+struct Format {
+    mask_t keep;
+    mask_t flip;
+    mask_t set;
+    size_t ref;
+
+    static constexpr Format absolute(mask_t mask) { return Format{0, 0, mask, 0}; }
+
+    mask_t resolve(const std::vector<mask_t>& entry) const {
+        mask_t base = entry[entry.size() - 1 - std::min(ref, entry.size() - 1)];  // pops stop at the bottom
+        return ((base & keep) ^ flip) | set;
+    }
+};
+
+// place in relative output that can be rendered only after the entry stack is known
+struct Hole {
+    enum { ANSI, CLOSING, TRIMMED } kind;
+    size_t offset;   // position in output
+    Format format;   // ANSI: format to print, CLOSING: format being closed
+    size_t padding;  // CLOSING: length of whitespace preceding closing delimiter, TRIMMED: length of whitespace
+};
+
+// output of relative processing of an input chunk
+struct Chunk {
+    std::string         out;
+    std::vector<Hole>   holes;
+    std::vector<Format> stack;                // formats left on top of the entry stack
+    size_t              entryPops;            // formats popped off the entry stack (not clamped)
+    int                 parsedColorParts;
+    bool                colorPartsSettled;    // parsedColorParts at exit doesn't depend on entry
+    bool                colorPartsDependent;  // colors were parsed with parsedColorParts from entry
+    Stats               stats;                // maxDepth relative to the entry stack
+    size_t              maxPushed;            // the most formats on top of the entry stack
+    size_t              closeLength;          // of closing delimiter
+    size_t              tailStore;            // characters left in store at the end, and their memory: serially
+    size_t              tailStoreBytes;       // they're still there when the next chunk's first one is stored
+
+    // writes output with holes filled for given entry stack
+    template <class Sink>
+    void render(const std::vector<mask_t>& entry, bool strip, Sink& sink) const {
+        size_t pos = 0;
+        for (const Hole& hole : holes) {
+            sink(out.data() + pos, hole.offset - pos);
+            pos = hole.offset;
+            if (hole.kind == Hole::ANSI) {
+                char ANSI[ANSI_MAX_LENGTH];
+                writeAnsi(sink, ANSI, formatToAnsi(hole.format.resolve(entry), ANSI));
+            } else if (hole.kind == Hole::TRIMMED) {
+                writeTrimmed(sink, out.data() + pos, hole.padding);
+                pos += hole.padding;
+            } else {
+                bool unbalanced = hole.format.ref >= entry.size() - 1;  // bracket isn't truncated then
+                bool trim       = (hole.format.resolve(entry) & TRIM) && !strip;
+                if (unbalanced) sink(out.data() + pos, hole.padding + closeLength);
+                else if (trim) writeTrimmed(sink, out.data() + pos, hole.padding);
+                else sink(out.data() + pos, hole.padding);
+                pos += hole.padding + closeLength;
+            }
+        }
+        sink(out.data() + pos, out.size() - pos);
+    }
+
+    // turns entry stack into exit stack
+    void advance(std::vector<mask_t>& entry) const {
+        std::vector<mask_t> pushed;
+        for (const Format& format : stack) pushed.push_back(format.resolve(entry));
+        entry.resize(entry.size() - std::min(entryPops, entry.size() - 1));
+        entry.insert(entry.end(), pushed.begin(), pushed.end());
+    }
+
+    // stats with maxDepth for given entry stack; pops are clamped at its bottom
+    Stats resolveStats(const std::vector<mask_t>& entry) const {
+        Stats resolved    = stats;
+        resolved.maxDepth = std::max(entry.size() - 1 + stats.maxDepth, maxPushed);
+        return resolved;
+    }
+};
+
+// pushing new formatting on stack introduces ANSI entry sequence
+// popping formatting from stack:
+//   1. outputs RESET sequence
+//   2. introduces stack's top ANSI entry sequence
+// thanks to that we can always reset on exit sequences
+//
+// Options are template parameters, so that every combination compiles to its own loop without
+// per-byte checks, e.g. stripping doesn't build ANSI sequences at all. See withOptions().
+template <class Sink, bool STRIP = false, bool ESCAPE = false, bool SANITIZE = true>
+class FormatterAutomaton {
+    static constexpr bool strip    = STRIP;     // should strip instead of printing ANSI
+    static constexpr bool escape   = ESCAPE;    // should escape special characters
+    static constexpr bool sanitize = SANITIZE;  // should print format reset in finish()
+    const bool            relative = false;     // is entry stack unknown (processing chunk of input)
+
+    enum STATE {
+        DEFAULT_STATE,
+        PARSE_ESCAPE_STATE,
+        PARSE_OPENING_BRACKET_STATE,
+        SKIP_LEADING_PADDING_STATE,
+    } state = DEFAULT_STATE;
+
+    // Store keeps raw bytes, except that a run of one character is packed once it has STORE_RUN_PACK bytes: it
+    // keeps STORE_RUN_KEPT of them and counts the rest, so that the run with its PackedRun takes no more than the
+    // bytes it replaces and grows no further. Short or alternating whitespace thus takes a byte per character as
+    // raw bytes do, and a blank region of any length takes constant memory.
+    struct PackedRun {
+        size_t end;    // in store, after the last kept byte of the run
+        size_t count;  // characters of the run beyond the kept ones
+    };
+
+    static constexpr size_t STORE_RUN_PACK = 2 * sizeof(PackedRun), STORE_RUN_KEPT = STORE_RUN_PACK - sizeof(PackedRun);
+
+    std::string            store;             // stores current buffered input if processing potential parts
+    std::vector<PackedRun> packedRuns;        // of store, in order
+    size_t                 storeLength = 0;   // characters in store, with the counted ones of packed runs
+    size_t                 storeTail   = 0;   // equal unpacked bytes at the end of store, 0 if unknown
+    const Delimiters*   delimiters;
+    uint8_t             match            = 0;   // state of delimiters' DFA after the characters in store
+    std::vector<Format> formatStack;            // formats pushed on entry stack (absolute when not relative)
+    mask_t              bracketMask      = EMPTY_FORMAT_MASK;
+    int                 parsedColorParts = 0;
+    bool                finished         = false;
+
+    Sink              out;
+    size_t            written             = 0;  // bytes written to `out`, offsets of holes
+    bool              batch               = false;  // inputs are started with next()
+    mask_t            shown               = EMPTY_FORMAT_MASK;  // last format printed, the one output is in
+    std::vector<Hole> holes;
+    size_t            entryPops           = 0;
+    bool              colorPartsSettled   = false;
+    bool              colorPartsDependent = false;
+
+    Stats  statistics;
+    size_t brackets  = 0;  // '{' accepted
+    size_t maxPushed = 0;  // relative mode: the most formats on top of the entry stack
+
+#pragma region innards
+
+    FORMATTER_CONSTEXPR void emit(const char* data, size_t size) {
+        written += size;
+        out(data, size);
+    }
+
+    // whether trimmed whitespace is needed: by the sink or to fill the holes of relative output later
+    FORMATTER_CONSTEXPR bool keepsTrimmed() const { return hasTrimmed<Sink>::value || relative; }
+
+    FORMATTER_CONSTEXPR void emitTrimmed(const char* data, size_t size) {
+        if (!relative) return writeTrimmed(out, data, size);
+        if (!holes.empty() && holes.back().kind == Hole::TRIMMED && holes.back().offset + holes.back().padding == written)
+            holes.back().padding += size;
+        else
+            holes.push_back(Hole{Hole::TRIMMED, written, Format(), size});
+        emit(data, size);
+    }
+
+    FORMATTER_CONSTEXPR void printANSI(const Format& format) {
+        if (strip) return;
+        ++statistics.ansi;
+        if (format.keep == 0 && !relative) {  // relative output keeps even absolute ANSI apart from text
+            char   ANSI[ANSI_MAX_LENGTH];
+            size_t length = formatToAnsi(format.set, ANSI);
+            written += length;
+            shown = format.set;
+            writeAnsi(out, ANSI, length);
+        } else
+            holes.push_back(Hole{Hole::ANSI, written, format, 0});
+    }
+
+    // top of the stack; in relative mode it can be the yet unknown format from entry stack
+    FORMATTER_CONSTEXPR Format top() const {
+        return formatStack.empty() ? Format{~mask_t(0), 0, 0, entryPops} : formatStack.back();
+    }
+
+    // whether popping would remove a format, unknown in relative mode for entry stack
+    FORMATTER_CONSTEXPR bool canPop() const { return formatStack.size() > (relative ? 0 : 1); }
+
+    // pushes format on stack and returns it
+    FORMATTER_CONSTEXPR Format pushFormat(mask_t mask) {
+        assert(mask & VALID);
+
+        Format format = top();
+
+        // 1. calculate the absolute format (or relative to the entry stack)
+        if (mask & RESET) format = Format::absolute(INITIAL_FORMAT_MASK);  // RESET to base off default mask
+        mask_t override = TRIM;                                            // trim doesn't propagate through stack
+        if (GET_FG(mask) != CURRENT_COLOR) override |= FG_MASK;            // override fg color from mask
+        if (GET_BG(mask) != CURRENT_COLOR) override |= BG_MASK;            // override bg color from mask
+        mask_t toggle = mask & FORMAT_MASK;                                // toggle the formatting specified in `mask`
+        format.set  = OVERRIDE(format.set ^ (toggle & ~format.keep), override, mask);
+        format.keep &= ~override;
+        format.flip = (format.flip ^ toggle) & format.keep;
+
+        // 2. store the format
+        formatStack.push_back(format);
+        size_t bottom = relative ? entryPops : 1;  // depth is relative to the entry stack in relative mode
+        if (formatStack.size() > bottom + statistics.maxDepth) statistics.maxDepth = formatStack.size() - bottom;
+        maxPushed = std::max(maxPushed, formatStack.size());
+        return format;
+    }
+
+    // pops format from stack and returns the one restored
+    FORMATTER_CONSTEXPR Format popFormat() {
+        if (canPop()) formatStack.pop_back();
+        else if (relative) ++entryPops;  // clamped to the bottom when resolved
+        return top();
+    }
+
+    FORMATTER_CONSTEXPR void emitRun(char c, size_t count, bool trimmed = false) {
+        char block[64];
+        std::fill_n(block, std::min(count, sizeof(block)), c);
+        for (size_t n; count > 0; count -= n) {
+            n = std::min(count, sizeof(block));
+            trimmed ? emitTrimmed(block, n) : emit(block, n);
+        }
+    }
+
+    // length of whitespace directly preceding the last `skip` characters of store. It walks the bytes of the
+    // padding, a packed run at once, as any of them could be the one that is not whitespace
+    FORMATTER_CONSTEXPR size_t storePadding(size_t skip) const {
+        size_t i = store.size(), run = packedRuns.size(), padding = 0;
+        while (i > 0) {
+            size_t count = 1;  // characters of store[i - 1]: its byte and the counted ones of a packed run
+            if (run > 0 && packedRuns[run - 1].end == i) count += packedRuns[--run].count;
+            char c = store[--i];
+            if (skip >= count) {
+                skip -= count;
+                continue;
+            }
+            if (!isSpace((unsigned char)c)) break;
+            padding += count - skip;
+            skip = 0;
+        }
+        return padding;
+    }
+
+    FORMATTER_CONSTEXPR void storeChar(int c) {
+        match = delimiters->step(match, c);
+        ++storeLength;
+        statistics.maxStore = std::max(statistics.maxStore, storeLength);
+        if (!packedRuns.empty() && packedRuns.back().end == store.size() && store.back() == (char)c)
+            return (void)++packedRuns.back().count;
+
+        storeTail = !store.empty() && store.back() == (char)c ? storeTail + 1 : 1;
+        store += (char)c;
+        if (storeTail == STORE_RUN_PACK) {
+            store.resize(store.size() - (STORE_RUN_PACK - STORE_RUN_KEPT));
+            packedRuns.push_back(PackedRun{store.size(), STORE_RUN_PACK - STORE_RUN_KEPT});
+        }
+        statistics.maxStoreBytes =
+            std::max(statistics.maxStoreBytes, store.size() + packedRuns.size() * sizeof(PackedRun));
+    }
+    FORMATTER_CONSTEXPR void clearStore() {
+        store.clear();
+        packedRuns.clear();
+        storeLength = storeTail = 0;
+        match       = 0;
+    }
+    // emits first `length` characters of store and removes them. The last kept byte of a packed run is emitted
+    // after its counted characters, so that a run flushed partially keeps its byte
+    FORMATTER_CONSTEXPR void flushStore(size_t length = SIZE_MAX, bool trimmed = false) {
+        auto   write = [&](const char* data, size_t size) { trimmed ? emitTrimmed(data, size) : emit(data, size); };
+        size_t pos = 0, run = 0;  // bytes and packed runs flushed
+        while (length > 0 && pos < store.size()) {
+            bool   packed = run < packedRuns.size();
+            size_t end    = packed ? packedRuns[run].end - 1 : store.size();
+            size_t n      = std::min(end - pos, length);
+            if (n > 0) write(store.data() + pos, n);
+            pos += n, length -= n, storeLength -= n;
+            if (!packed || length == 0) continue;
+
+            size_t count = std::min(packedRuns[run].count, length);
+            emitRun(store[end], count, trimmed);
+            length -= count, storeLength -= count;
+            if ((packedRuns[run].count -= count) > 0) break;
+            ++run;  // its last byte is an unpacked one now
+        }
+        store.erase(0, pos);
+        packedRuns.erase(packedRuns.begin(), packedRuns.begin() + run);
+        for (PackedRun& packedRun : packedRuns) packedRun.end -= pos;
+        storeTail = 0;
+        if (storeLength == 0) match = 0;
+    }
+    // removes last `length` characters of store
+    FORMATTER_CONSTEXPR void dropStore(size_t length) {
+        while (length > 0) {
+            size_t end = packedRuns.empty() ? 0 : packedRuns.back().end;
+            if (end == store.size()) {  // counted characters of the last run go first
+                size_t count = std::min(packedRuns.back().count, length);
+                length -= count, storeLength -= count;
+                if ((packedRuns.back().count -= count) == 0) packedRuns.pop_back();
+                continue;
+            }
+            size_t n = std::min(store.size() - end, length);
+            store.resize(store.size() - n);
+            length -= n, storeLength -= n;
+        }
+        storeTail = 0;
+    }
+
+    // emits translated escape sequence instead of the stored backslash
+    FORMATTER_CONSTEXPR void emitEscape(const char* c) {
+        clearStore();
+        emit(c, 1);
+        ++statistics.escapes;
+    }
+
+    FORMATTER_CONSTEXPR void cleanAfterBracketParse(bool parseSuccess) {
+        parseSuccess ? clearStore() : flushStore();
+        parsedColorParts  = 0;
+        colorPartsSettled = true;
+        state             = (parseSuccess && (bracketMask & TRIM)) ? SKIP_LEADING_PADDING_STATE : DEFAULT_STATE;
+        bracketMask       = EMPTY_FORMAT_MASK;
+    }
+
+    struct RelativeTag {};
+    FORMATTER_CONSTEXPR FormatterAutomaton(RelativeTag, Sink out, int parsedColorParts, const Delimiters& delimiters)
+        : relative(true), delimiters(&delimiters), parsedColorParts(parsedColorParts), out(out) {}
+
+#pragma endregion
+
+   public:
+    FORMATTER_CONSTEXPR explicit FormatterAutomaton(Sink out, const Delimiters& delimiters = DEFAULT_DELIMITERS)
+        : delimiters(&delimiters), out(out) {
+        formatStack.push_back(Format::absolute(INITIAL_FORMAT_MASK));
+        printANSI(formatStack.back());
+    }
+
+    // relative mode: processes chunk of input before the stack it's entered with is known
+    static FormatterAutomaton relativeTo(Sink out, int parsedColorParts,
+                                         const Delimiters& delimiters = DEFAULT_DELIMITERS) {
+        return FormatterAutomaton(RelativeTag(), out, parsedColorParts, delimiters);
+    }
+
+    FORMATTER_CONSTEXPR ~FormatterAutomaton() {
+        if (!relative) finish();
+    }
+
+    FORMATTER_CONSTEXPR Sink&       sink() { return out; }
+    FORMATTER_CONSTEXPR const Sink& sink() const { return out; }
+
+    // whether a run of plain characters ending with a visible one (see Delimiters::isPlain()) would be copied to
+    // output verbatim now, so that it can bypass the automaton if reported with skipped()
+    FORMATTER_CONSTEXPR bool resting() const { return state == DEFAULT_STATE && storeLength == 0 && !relative; }
+    FORMATTER_CONSTEXPR void skipped(std::string_view run) {
+        statistics.bytesIn += run.size();
+        for (char c : run) {  // whitespace goes through the store up to the next visible character, for stats only
+            if (isSpace((unsigned char)c)) storeChar(c);
+            else if (storeLength > 0) storeChar(c), clearStore();
+        }
+        statistics.maxStore      = std::max<size_t>(statistics.maxStore, !run.empty());
+        statistics.maxStoreBytes = std::max<size_t>(statistics.maxStoreBytes, !run.empty());
+    }
+
+    FORMATTER_CONSTEXPR Stats stats() const {
+        Stats result        = statistics;
+        result.rejectedTags = brackets - statistics.openingTags;  // pending one is rejected by finish()
+        return result;
+    }
+
+    // flushes buffered input and resets format if sanitizing; further input needs reset(). In a batch of next()
+    // inputs the reset is printed only if output is left formatted, as next() does.
+    FORMATTER_CONSTEXPR void finish() {
+        if (finished) return;
+        flushStore();
+        if (sanitize && (!batch || shown != INITIAL_FORMAT_MASK))
+            printANSI(Format::absolute(INITIAL_FORMAT_MASK));
+        finished = true;
+    }
+
+    // starts new input from initial state, as if automaton was just constructed
+    FORMATTER_CONSTEXPR void reset() {
+        finish();
+        state            = DEFAULT_STATE;
+        bracketMask      = EMPTY_FORMAT_MASK;
+        parsedColorParts = 0;
+        finished         = false;
+        formatStack.resize(1);
+        printANSI(formatStack.back());
+    }
+
+    // starts new input in the same output, as finish() and reset() do, but the stack is reset only logically:
+    // a single format reset is printed only if the previous input left output formatted, so a batch of
+    // balanced inputs gets no ANSI between them
+    FORMATTER_CONSTEXPR void next() {
+        flushStore();
+        state            = DEFAULT_STATE;
+        bracketMask      = EMPTY_FORMAT_MASK;
+        parsedColorParts = 0;
+        finished         = false;
+        formatStack.resize(1);
+        if (shown != formatStack.back().set) printANSI(formatStack.back());
+        batch = true;
+    }
+
+    // formats whole input separately from the previous one
+    FORMATTER_CONSTEXPR void format(std::string_view input) {
+        if (finished) reset();
+        feed(input);
+        finish();
+    }
+
+    // ends relative processing and hands over the output
+    Chunk release() {
+        size_t tailStore = storeLength, tailStoreBytes = store.size() + packedRuns.size() * sizeof(PackedRun);
+        flushStore();
+        return Chunk{std::move(out.out), std::move(holes), std::move(formatStack), entryPops,
+                     parsedColorParts, colorPartsSettled, colorPartsDependent, stats(), maxPushed,
+                     delimiters->close.size(), tailStore, tailStoreBytes};
+    }
+
+    FORMATTER_CONSTEXPR void feed(std::string_view chunk) {
+        for (char c : chunk) accept((unsigned char)c);
+    }
+
+    FORMATTER_CONSTEXPR void accept(int c) {
+        size_t found = std::string_view::npos;
+        ++statistics.bytesIn;
+
+
+        // parsing escape
+        if (state == PARSE_ESCAPE_STATE) {
+            switch (c) {
+                case '\\': emitEscape("\\"); break; // backslash
+                case 'a' : emitEscape("\a"); break; // alert (bell)
+                case 'b' : emitEscape("\b"); break; // backspace
+                case 'r' : emitEscape("\r"); break; // carraiage return
+                case 'n' : emitEscape("\n"); break; // newline (line feed)
+                case 'f' : emitEscape("\f"); break; // form feed
+                case 't' : emitEscape("\t"); break; // horizontal tab
+                case 'v' : emitEscape("\v"); break; // vertical tab
+                default:                          // invalid escape - print as is
+                    storeChar(c);
+                    flushStore();
+                    break;
+            }
+            state = DEFAULT_STATE;
+        } else if (escape && c == '\\') {
+            flushStore();
+            storeChar(c);  // store = "\"
+            state = PARSE_ESCAPE_STATE;
+        }
+
+
+        // potential whitespace trimming - memory grows with whitespace, but not with long runs of one character
+        // whitespace stays in store until next visible character, as it might be a part of bracket
+        else if (isSpace(c)) {
+            if (state != SKIP_LEADING_PADDING_STATE || strip)  // skip whitespace if trim mode
+                storeChar(c);
+            else if (keepsTrimmed()) {
+                char whitespace = c;
+                emitTrimmed(&whitespace, 1);
+            }
+        }
+
+
+        // anything else is stored first, as it may be a part of delimiter
+        else {
+            storeChar(c);
+            uint8_t matched = delimiters->matches(match);
+            bool    bracket = state == PARSE_OPENING_BRACKET_STATE;
+
+            // parsking end of opening bracket
+            if (bracket && (matched & Delimiters::SEPARATOR)) {  // success parsing bracket
+                // deal with empty format {--
+                ++statistics.openingTags;
+                printANSI(pushFormat(bracketMask));
+                return cleanAfterBracketParse(true);
+            }
+
+
+            // end the formatting. trippy: {--}
+            else if (matched & Delimiters::CLOSE) {
+                size_t close   = delimiters->close.size();
+                size_t padding = storePadding(close);  // whitespace before '--}'
+                ++statistics.closingTags;
+
+                if (relative && formatStack.empty()) {  // closing format from entry stack, truncation is unknown
+                    flushStore(storeLength - padding - close);
+                    holes.push_back(Hole{Hole::CLOSING, written, top(), padding});
+                } else if (canPop()) {  // don't truncate unbalanced pairs
+                    if ((top().set & TRIM) && !strip) {
+                        if (keepsTrimmed()) {
+                            flushStore(storeLength - padding - close);
+                            flushStore(padding, true);
+                        } else
+                            dropStore(padding);
+                    }
+                    dropStore(close);
+                }
+
+                flushStore();
+
+                printANSI(popFormat());
+                state = DEFAULT_STATE;
+            }
+
+
+            // begin bracket parsing
+            else if (matched & Delimiters::OPEN) {
+                flushStore(storeLength - delimiters->open.size());
+                match       = 0;  // the separator starts after the opening delimiter, can't overlap it
+                bracketMask = EMPTY_FORMAT_MASK;
+                state       = PARSE_OPENING_BRACKET_STATE;
+                ++brackets;
+            }
+
+
+            // parsing options of opening bracket; '-' is only a placeholder in formatChars
+            else if (bracket && !delimiters->inSeparator(c) && c != '-' &&
+                     (found = formatChars.find(c)) != std::string_view::npos) {
+                // dealing with color
+                if (found <= 18) {               // a ';' can be passed here
+                    if (!colorPartsSettled) colorPartsDependent = true;
+                    if (parsedColorParts < 2) {  // fg, bg not set
+                        bracketMask = WITH_COLOR(bracketMask, isUpper(c) ? LIGHTER(found - 11) : found, parsedColorParts);
+                        ++parsedColorParts;
+                    } else {  // too much color parts
+                        return cleanAfterBracketParse(false);
+                    }
+
+                    // dealing with symbols
+                } else {
+                    mask_t opMask;
+                    switch (c) {  // todo check if valid
+                        case '%': opMask = REVERSED; break;
+                        case '!': opMask = BLINK; break;
+                        case '*': opMask = BOLD; break;
+                        case '/': opMask = ITALIC; break;
+                        case '_': opMask = UNDERLINE; break;
+                        case '^': opMask = OVERLINE; break;
+                        case '=': opMask = DOUBLE_UNDERLINE; break;
+                        case '~': opMask = STRIKETHROUGH; break;
+                        case '.': opMask = DIM; break;
+                        case '#': opMask = TRIM; break;
+                        case '0': opMask = RESET; break;
+                    }
+                    if (bracketMask & opMask)  // operator was already used
+                        return cleanAfterBracketParse(false);
+                    else
+                        bracketMask |= opMask;
+                }
+            }
+
+
+            // possible part of a delimiter, e.g. '-' of '--' or '--}', stays in store
+            else if (match != 0) {
+                if (!bracket) state = DEFAULT_STATE;  // to exit eventual trailing whitespace removal mode
+            }
+
+
+            // any normal characters or breaking current context
+            else {
+                flushStore();
+                state = DEFAULT_STATE;
+            }
+        }
+    }
+};
+
+// Calls f(strip, escape, sanitize) with the options as std::bool_constant, so that runtime options select
+// one of the automaton instantiations once:
+//
+//     withOptions(strip, false, true, [&](auto strip, auto escape, auto sanitize) {
+//         FormatterAutomaton<FileSink, strip, escape, sanitize> automaton{FileSink(stdout)};
+//         ...
+//     });
+template <class F>
+void withOptions(bool strip, bool escape, bool sanitize, F&& f) {
+    auto pick = [](bool flag, auto&& next) { flag ? next(std::true_type()) : next(std::false_type()); };
+    pick(strip, [&](auto S) { pick(escape, [&](auto E) { pick(sanitize, [&](auto Z) { f(S, E, Z); }); }); });
+}
+
+
+// Formats input using `jobs` threads as it is fed. Input is cut into chunks of about `chunkSize` bytes at the
+// starts of lines for which Delimiters::isResync() holds, a pool of `jobs` workers processes every chunk in
+// relative mode and the holes of each one are filled in order as soon as the chunks before it are written,
+// with the entry stack resolved from the previous chunk's exit stack. At most jobs + 1 chunks are in flight,
+// so memory stays around that many chunks of input and output. Output equals serial one and finish() returns
+// stats of the whole input, the same as serial automaton's.
+template <bool strip = false, bool escape = false, bool sanitize = true, class Sink = FileSink>
+class ParallelFormatter {
+   public:
+    static constexpr size_t CHUNK_SIZE = 1 << 20;
+
+    ParallelFormatter(unsigned jobs, Sink& sink, const Delimiters& delimiters = DEFAULT_DELIMITERS,
+                      size_t chunkSize = CHUNK_SIZE)
+        : sink(sink), delimiters(delimiters), chunkSize(std::max<size_t>(chunkSize, 1)), window(jobs + 1) {
+        for (unsigned job = 0; job < jobs; ++job) workers.emplace_back([this] { work(); });
+        if (!strip) writeAnsi(sink, ANSI, formatToAnsi(INITIAL_FORMAT_MASK, ANSI)), ++stats.ansi;
+    }
+
+    ~ParallelFormatter() { stop(); }
+
+    // copies input to the current chunk, which is cut off at the first line start to resync at after chunkSize
+    // bytes. Input is taken in steps past chunkSize, so that only the rest of a step is copied again.
+    void feed(std::string_view input) {
+        while (!input.empty()) {
+            size_t take = std::min(input.size(), pending.size() < chunkSize ? chunkSize - pending.size() : STEP);
+            pending.append(input.data(), take);
+            input.remove_prefix(take);
+
+            size_t pos = scanned = cut(pending, std::max(chunkSize, scanned));
+            if (pos >= pending.size()) continue;
+            std::string rest = pending.substr(pos);
+            pending.resize(pos);
+            submit(std::move(pending), {});
+            pending = std::move(rest);
+            scanned = 0;
+        }
+    }
+
+    // feeds the whole rest of input, which stays valid until finish(), without copying it, e.g. a mapped file
+    void feedWhole(std::string_view input) {
+        if (!pending.empty()) return feed(input);
+        for (size_t pos; !input.empty(); input.remove_prefix(pos))
+            submit({}, input.substr(0, pos = cut(input, chunkSize)));
+    }
+
+    // writes the rest of output and returns stats of the whole input
+    Stats finish() {
+        if (!pending.empty()) submit(std::move(pending), {});
+        pending.clear();
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!inFlight.empty()) writeFront(lock);
+        lock.unlock();
+        stop();
+        if (sanitize && !strip) writeAnsi(sink, ANSI, formatToAnsi(INITIAL_FORMAT_MASK, ANSI)), ++stats.ansi;
+        return stats;
+    }
+
+   private:
+    static constexpr size_t STEP = 1 << 16;
+
+    struct Job {
+        std::string      owned;  // input, unless it is fed whole
+        std::string_view input;
+        Chunk            chunk;
+        bool             done = false;
+    };
+
+    Sink&                    sink;
+    const Delimiters&        delimiters;
+    const size_t             chunkSize;
+    const size_t             window;  // chunks in flight
+    std::string              pending;  // input of the next chunk
+    size_t                   scanned = 0;  // of pending, for a line start to cut at
+    std::deque<Job>          inFlight;  // in input order; references stay valid as only the ends change
+    std::deque<Job*>         queue;     // jobs no worker has taken yet
+    std::mutex               mutex;
+    std::condition_variable  queued, done;
+    bool                     stopping = false;
+    std::vector<std::thread> workers;
+
+    std::vector<mask_t> stack{INITIAL_FORMAT_MASK};
+    int                 parsedColorParts = 0;
+    Stats               stats;
+    bool                written = false;  // some chunk, so that its tail store counts for the next one
+    size_t              tailStore = 0, tailStoreBytes = 0;
+    char                ANSI[ANSI_MAX_LENGTH];
+
+    // first line start to resync at from `from`, data.size() if there's none
+    size_t cut(std::string_view data, size_t from) const {
+        size_t pos = from;
+        while (pos < data.size() && !(data[pos - 1] == '\n' && delimiters.isResync((unsigned char)data[pos]))) {
+            const char* nl = (const char*)memchr(data.data() + pos, '\n', data.size() - pos);
+            pos            = nl ? nl - data.data() + 1 : data.size();
+        }
+        return std::min(pos, data.size());
+    }
+
+    Chunk process(std::string_view input, int parsedColorParts) const {
+        StringSink out;
+        out.out.reserve(input.size() + input.size() / 8);  // output is mostly input, tags turned to ANSI
+        auto automaton = FormatterAutomaton<StringSink, strip, escape>::relativeTo(std::move(out), parsedColorParts, delimiters);
+        automaton.feed(input);
+        return automaton.release();
+    }
+
+    void work() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            queued.wait(lock, [&] { return stopping || !queue.empty(); });
+            if (stopping) return;
+            Job* job = queue.front();
+            queue.pop_front();
+            lock.unlock();
+            Chunk chunk = process(job->input, 0);
+            lock.lock();
+            job->chunk = std::move(chunk);
+            job->done  = true;
+            done.notify_one();
+        }
+    }
+
+    // owned input or a view of input fed whole
+    void submit(std::string owned, std::string_view input) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (inFlight.size() >= window) writeFront(lock);
+        Job& job  = inFlight.emplace_back();
+        job.owned = std::move(owned);
+        job.input = input.empty() ? std::string_view(job.owned) : input;
+        queue.push_back(&job);
+        queued.notify_one();
+    }
+
+    // waits for the first chunk in flight, writes it and frees its memory
+    void writeFront(std::unique_lock<std::mutex>& lock) {
+        done.wait(lock, [&] { return inFlight.front().done; });
+        Job& job = inFlight.front();
+        lock.unlock();
+
+        Chunk& chunk = job.chunk;
+        if (chunk.colorPartsDependent && parsedColorParts != 0)  // speculation failed
+            chunk = process(job.input, parsedColorParts);
+        chunk.render(stack, strip, sink);
+        stats += chunk.resolveStats(stack);
+        if (written) {  // a chunk starts with a visible character, stored after what the previous one left
+            stats.maxStore      = std::max(stats.maxStore, tailStore + 1);
+            stats.maxStoreBytes = std::max(stats.maxStoreBytes, tailStoreBytes + 1);
+        }
+        chunk.advance(stack);
+        if (chunk.colorPartsSettled || chunk.colorPartsDependent)  // otherwise it parsed no colors
+            parsedColorParts = chunk.parsedColorParts;
+        tailStore = chunk.tailStore, tailStoreBytes = chunk.tailStoreBytes, written = true;
+
+        lock.lock();
+        inFlight.pop_front();
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        queued.notify_all();
+        for (std::thread& worker : workers) worker.join();
+        workers.clear();
+    }
+};
+
+// Formats whole input using `jobs` threads, see ParallelFormatter. Inputs smaller than `jobs` chunks are split
+// evenly between the threads. Returns stats of the whole input, the same as serial automaton's.
+template <bool strip = false, bool escape = false, bool sanitize = true, class Sink>
+Stats formatParallel(std::string_view input, unsigned jobs, Sink& sink,
+                     const Delimiters& delimiters = DEFAULT_DELIMITERS, size_t chunkSize = 0) {
+    using Formatter = ParallelFormatter<strip, escape, sanitize, Sink>;
+    if (chunkSize == 0) chunkSize = std::min(Formatter::CHUNK_SIZE, input.size() / jobs + 1);
+    Formatter formatter{jobs, sink, delimiters, chunkSize};
+    formatter.feedWhole(input);
+    return formatter.finish();
+}
+
+#if __cplusplus >= 202002L
+
+// string literal usable as a template argument
+template <size_t N>
+struct FixedString {
+    char data[N];
+
+    constexpr FixedString(const char (&literal)[N]) { std::copy_n(literal, N, data); }
+
+    constexpr std::string_view view() const { return std::string_view(data, N - 1); }
+};
+
+// sinks for compile time rendering: first the output is measured, then copied
+struct CountSink {
+    size_t size = 0;
+
+    constexpr void operator()(const char*, size_t length) { size += length; }
+};
+
+struct PointerSink {
+    char* it;
+
+    constexpr void operator()(const char* data, size_t size) { it = std::copy_n(data, size, it); }
+};
+
+// formats input at compile time, the same way as a separate argument of the CLI; NUL terminated
+template <FixedString input, bool strip = false, bool escape = false, bool sanitize = true>
+consteval auto render() {
+    constexpr size_t size = [] {
+        FormatterAutomaton<CountSink, strip, escape, sanitize> automaton{CountSink()};
+        automaton.format(input.view());
+        return automaton.sink().size;
+    }();
+
+    std::array<char, size + 1> out{};
+    FormatterAutomaton<PointerSink, strip, escape, sanitize> automaton{PointerSink{out.data()}};
+    automaton.format(input.view());
+    return out;
+}
+
+template <FixedString input, bool strip = false, bool escape = false, bool sanitize = true>
+inline constexpr auto rendered = render<input, strip, escape, sanitize>();
+
+inline namespace literals {
+
+// "{R*--ERROR--} disk is full"_fmt is the string with tags already translated to ANSI
+template <FixedString input>
+constexpr std::string_view operator""_fmt() {
+    return std::string_view(rendered<input>.data(), rendered<input>.size() - 1);
+}
+
+}  // namespace literals
+
+#endif
+
+}  // namespace formatter